@@ -0,0 +1,39 @@
+// A mod that times the batched action code in the game, instead of adding AI actions. Actions can only be created
+// against the game's AI, so this can't run with the analysis checks in AnalysisRunner.
+//
+// Set AI_MOD_BENCHMARKS to 1 to run the benchmarks once, the first time the game creates actions for an AI.
+// Results are written to the game's log.
+
+#include <game/StdAfx.h>
+#include <game/AI.h>
+#include <game/AI_modapi.h>
+#include <internal/Benchmarks.h>
+#include <internal/Macros.h>
+#include <internal/Utils.h>
+
+#include <mutex>
+#include <stdlib.h>
+
+// Exported API
+extern "C" {
+	__declspec(dllexport) void GetApiVersion(int * major, int * minor);
+	__declspec(dllexport) bool CreateAiActions(AI* ai);
+}
+
+static std::once_flag benchmarksRun;
+static void runBenchmarks(AI* ai) {
+	auto enabled = getenv("AI_MOD_BENCHMARKS");
+	if (!enabled || !*enabled || !strcmp(enabled, "0")) return;
+	aiModInternal::runActionBenchmarks(ai);
+	DPRINT_LOW_REPORT("Benchmarks finished.");
+}
+
+void GetApiVersion(int * major, int * minor) {
+	*major = 1;
+	*minor = 0;
+}
+
+bool CreateAiActions(AI* ai) {
+	std::call_once(benchmarksRun, runBenchmarks, ai);
+	return true;
+}
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+# Writes synthetic.pe32, a small PE32 image laid out the way the built-in signatures in
+# src/internal/Analysis.cpp expect Reassembly to be, and corpus.txt, the RVAs they should resolve to.
+# The image is data only: its code is never run, only decoded.
+#
+#     python3 fixtures/make_synthetic.py
+#
+# Run it again after changing the layout below, and check in both files.
+
+import os
+import struct
+
+IMAGE_BASE = 0x10000000
+TEXT, RDATA, DATA = 0x1000, 0x2000, 0x3000
+SECTION_SIZE = 0x1000
+FILE_ALIGNMENT = 0x200
+HEADERS_SIZE = 0x400
+
+text = bytearray(b"\xCC" * SECTION_SIZE)
+rdata = bytearray(SECTION_SIZE)
+data = bytearray(SECTION_SIZE)
+sections = {TEXT: text, RDATA: rdata, DATA: data}
+exports = {}
+expected = {}
+
+
+def va(rva):
+    return IMAGE_BASE + rva
+
+
+def put(rva, blob):
+    for base, section in sections.items():
+        if base <= rva < base + SECTION_SIZE:
+            section[rva - base:rva - base + len(blob)] = blob
+            return
+    raise ValueError("RVA 0x%x is outside of every section" % rva)
+
+
+def u32(value):
+    return struct.pack("<I", value)
+
+
+# Instructions, each given the RVA it starts at where it's relative.
+def push(address):
+    return b"\x68" + u32(address)
+
+
+def call(at, target):
+    return b"\xE8" + struct.pack("<i", target - (at + 5))
+
+
+def code(rva, *parts):
+    # Each part is bytes, or a function of the RVA it starts at.
+    blob = bytearray()
+    for part in parts:
+        blob += part(rva + len(blob)) if callable(part) else part
+    put(rva, bytes(blob))
+
+
+def calls(target):
+    return lambda at: call(at, target)
+
+
+RET = b"\xC3"
+ADD_ESP_4 = b"\x83\xC4\x04"
+MOV_ESI_EAX = b"\x8B\xF0"
+MOV_ECX_ESI = b"\x8B\xCE"
+
+# Nothing is placed at the start of a section, as Segment::containsOffset excludes it.
+# Strings.
+NOTIFY_STRING = RDATA + 0x010
+UNLOCKED_FACTION = RDATA + 0x030
+BLOCK_OVERLAP = RDATA + 0x050
+put(NOTIFY_STRING, b"Notifier::notify\0")
+put(UNLOCKED_FACTION, b"Unlocked Faction\0")
+put(BLOCK_OVERLAP, b"kBlockOverlap\0")
+
+# Functions that are only called. Each is at a 0x10 byte boundary after 0xCC padding, as MSVC lays them out.
+HELPER = TEXT + 0x040
+code(HELPER, RET)
+
+# Notifier::notify contains its assert string, and Block::addResource calls it on the result of Notifier::instance,
+# which is kept in ESI across another call so that the call before Notifier::notify isn't Notifier::instance.
+NOTIFIER_INSTANCE = TEXT + 0x010
+NOTIFIER_NOTIFY = TEXT + 0x020
+code(NOTIFIER_INSTANCE, RET)
+code(NOTIFIER_NOTIFY, push(va(NOTIFY_STRING)), ADD_ESP_4, RET)
+ADD_RESOURCE = TEXT + 0x100
+code(ADD_RESOURCE, calls(HELPER), calls(NOTIFIER_INSTANCE), MOV_ESI_EAX, calls(HELPER), MOV_ECX_ESI, calls(NOTIFIER_NOTIFY),
+     RET)
+exports["?addResource@Block@@QAEMMU?$tvec2@M$0A@@glm@@@Z"] = ADD_RESOURCE
+expected["Notifier::instance"] = NOTIFIER_INSTANCE
+expected["Notifier::notify"] = NOTIFIER_NOTIFY
+
+# Block::launchUpdate compares globals.player to 0, and the signature takes off offsetof(Globals, player). The
+# game's layout of Globals can't be built outside of Windows, so this is the offset in the layout declared by
+# headless/include/game/StdAfx.h, which is what AnalysisRunner is built with.
+GLOBALS_PLAYER_OFFSET = 8
+PLAYER = DATA + 0x100
+LAUNCH_UPDATE = TEXT + 0x200
+code(LAUNCH_UPDATE, b"\x83\x3D" + u32(va(PLAYER)) + b"\x00", RET)
+exports["?launchUpdate@Block@@AAE_NI@Z"] = LAUNCH_UPDATE
+expected["globals"] = PLAYER - GLOBALS_PLAYER_OFFSET
+
+# "Unlocked Faction" is passed to gettext_, string::string and Player::setMessage. It's referenced once before
+# that by a function that calls gettext_, but not first, which the signature has to skip.
+GETTEXT = TEXT + 0x300
+STRING_CONSTRUCTOR = TEXT + 0x310
+PLAYER_SET_MESSAGE = TEXT + 0x320
+code(GETTEXT, RET)
+code(STRING_CONSTRUCTOR, RET)
+code(PLAYER_SET_MESSAGE, RET)
+exports["?gettext_@@YAPBDPBD@Z"] = GETTEXT
+code(TEXT + 0x380, push(va(UNLOCKED_FACTION)), calls(HELPER), calls(GETTEXT), ADD_ESP_4, calls(STRING_CONSTRUCTOR),
+     calls(HELPER), RET)
+code(TEXT + 0x400, push(va(UNLOCKED_FACTION)), calls(GETTEXT), ADD_ESP_4, calls(STRING_CONSTRUCTOR),
+     calls(PLAYER_SET_MESSAGE), RET)
+expected["Player::setMessage"] = PLAYER_SET_MESSAGE
+
+# CVarBase has RTTI: a type descriptor in .data, and a complete object locator, class hierarchy and base class
+# descriptor in .rdata, with the locator in the slot before the vftable.
+TYPE_DESCRIPTOR = DATA + 0x010
+LOCATOR = RDATA + 0x300
+HIERARCHY = RDATA + 0x320
+BASE_CLASS_ARRAY = RDATA + 0x340
+BASE_CLASS = RDATA + 0x350
+VFTABLE = RDATA + 0x384
+put(TYPE_DESCRIPTOR, u32(0) + u32(0) + b".?AVCVarBase@@\0")
+put(LOCATOR, u32(0) + u32(0) + u32(0) + u32(va(TYPE_DESCRIPTOR)) + u32(va(HIERARCHY)))
+put(HIERARCHY, u32(0) + u32(0) + u32(1) + u32(va(BASE_CLASS_ARRAY)))
+put(BASE_CLASS_ARRAY, u32(va(BASE_CLASS)))
+put(BASE_CLASS, u32(va(TYPE_DESCRIPTOR)))
+put(VFTABLE - 4, u32(va(LOCATOR)))
+CVAR_DESTRUCTOR = TEXT + 0x500
+code(CVAR_DESTRUCTOR, RET)
+put(VFTABLE, u32(va(CVAR_DESTRUCTOR)))
+
+# The CVarBase constructor stores the vftable and makes three calls, the second of which is CVarBase::index. The
+# kBlockOverlap CVar is constructed right after its name is pushed.
+CVAR_BASE = TEXT + 0x600
+CVAR_INDEX = TEXT + 0x690
+code(TEXT + 0x680, RET)
+code(CVAR_INDEX, RET)
+code(TEXT + 0x6A0, RET)
+code(CVAR_BASE, b"\xC7\x01" + u32(va(VFTABLE)), calls(TEXT + 0x680), calls(CVAR_INDEX), calls(TEXT + 0x6A0), RET)
+code(TEXT + 0x700, push(va(BLOCK_OVERLAP)), b"\xB9" + u32(va(DATA + 0x200)), calls(CVAR_BASE), RET)
+expected["CVarBase::index"] = CVAR_INDEX
+
+# The export directory, with names sorted so they can be binary searched.
+EXPORT_DIRECTORY = RDATA + 0x800
+names = sorted(exports)
+functions = EXPORT_DIRECTORY + 40
+name_pointers = functions + 4 * len(names)
+ordinals = name_pointers + 4 * len(names)
+strings = ordinals + 2 * len(names)
+put(EXPORT_DIRECTORY, struct.pack("<IIHHIIIIIII", 0, 0, 0, 0, 0, 1, len(names), len(names), functions,
+                                  name_pointers, ordinals))
+for i, name in enumerate(names):
+    put(functions + 4 * i, u32(exports[name]))
+    put(name_pointers + 4 * i, u32(strings))
+    put(ordinals + 2 * i, struct.pack("<H", i))
+    put(strings, name.encode() + b"\0")
+    strings += len(name) + 1
+export_size = strings - EXPORT_DIRECTORY
+
+# Headers.
+SECTION_NAMES = [(".text", TEXT, 0x60000020), (".rdata", RDATA, 0x40000040), (".data", DATA, 0xC0000040)]
+headers = bytearray(HEADERS_SIZE)
+headers[0:2] = b"MZ"
+headers[0x3C:0x40] = u32(0x80)
+pe = 0x80
+headers[pe:pe + 4] = b"PE\0\0"
+file_header = struct.pack("<HHIIIHH", 0x14C, len(SECTION_NAMES), 0x5EED0001, 0, 0, 224, 0x2102)
+headers[pe + 4:pe + 24] = file_header
+directories = [(0, 0)] * 16
+directories[0] = (EXPORT_DIRECTORY, export_size)
+optional_header = struct.pack(
+    "<HBBIIIIIIIIIHHHHHHIIIIHHIIIIII", 0x10B, 14, 0, SECTION_SIZE, 2 * SECTION_SIZE, 0, 0, TEXT, RDATA, IMAGE_BASE,
+    0x1000, FILE_ALIGNMENT, 6, 0, 0, 0, 6, 0, 0, DATA + SECTION_SIZE, HEADERS_SIZE, 0, 2, 0x140, 0x100000, 0x1000,
+    0x100000, 0x1000, 0, 16)
+optional_header += b"".join(struct.pack("<II", *directory) for directory in directories)
+headers[pe + 24:pe + 24 + len(optional_header)] = optional_header
+section_table = pe + 24 + len(optional_header)
+for i, (name, rva, characteristics) in enumerate(SECTION_NAMES):
+    pointer = HEADERS_SIZE + i * SECTION_SIZE
+    entry = struct.pack("<8sIIIIIIHHI", name.encode(), SECTION_SIZE, rva, SECTION_SIZE, pointer, 0, 0, 0, 0,
+                        characteristics)
+    headers[section_table + 40 * i:section_table + 40 * (i + 1)] = entry
+
+directory = os.path.dirname(os.path.abspath(__file__))
+with open(os.path.join(directory, "synthetic.pe32"), "wb") as image:
+    image.write(headers + text + rdata + data)
+with open(os.path.join(directory, "corpus.txt"), "w", newline="\r\n") as corpus:
+    corpus.write("# Written by make_synthetic.py.\n")
+    corpus.write("image synthetic.pe32\n")
+    for name in sorted(expected):
+        corpus.write("%s 0x%x\n" % (name, expected[name]))
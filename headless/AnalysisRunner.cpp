@@ -0,0 +1,37 @@
+// Runs the analysis checks outside of the game, on images read from disk:
+//
+//     AnalysisRunner fixtures/corpus.txt          Runs every resolver on the images listed in a corpus manifest.
+//     AnalysisRunner --benchmark Reassembly.exe   Times the analysis code on an image.
+//
+// The resolver suite exits with a non-zero status if any checked resolver fails. CMakeLists.txt runs it on
+// fixtures/corpus.txt as a test.
+
+#include <game/StdAfx.h>
+#include <internal/AnalysisCore.h>
+#include <internal/Benchmarks.h>
+#include <internal/ResolverSuite.h>
+#include <internal/Macros.h>
+#include <internal/Utils.h>
+
+#include <string.h>
+
+static int runResolverCorpus(const char* manifestPath) {
+	auto corpus = aiModInternal::loadResolverCorpus(manifestPath);
+	auto results = aiModInternal::runResolverSuite(corpus);
+	auto passed = aiModInternal::logResolverResults(results);
+	DPRINT_LOW("Resolver suite %s.", passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+}
+
+static int runBenchmarks(const char* imagePath) {
+	aiModInternal::PEModule module{ string(imagePath) };
+	aiModInternal::runAnalysisBenchmarks(module);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 2 && strcmp(argv[1], "--benchmark")) return runResolverCorpus(argv[1]);
+	if (argc == 3 && !strcmp(argv[1], "--benchmark")) return runBenchmarks(argv[2]);
+	fprintf(stderr, "Usage: %s <corpus manifest>\n       %s --benchmark <image>\n", argv[0], argv[0]);
+	return 2;
+}
@@ -0,0 +1,56 @@
+#include <game/StdAfx.h>
+
+#include <cxxabi.h>
+#include <stdlib.h>
+
+// The game functions the analysis code calls, for builds that run outside of the game. Formatting matches
+// the game's libs/core/Str.cpp, and reports go to stdout.
+
+std::string str_format(const char *format, ...) {
+	va_list vl;
+	va_start(vl, format);
+	std::string s = str_vformat(format, vl);
+	va_end(vl);
+	return s;
+}
+std::string str_vformat(const char *format, va_list vl) {
+	va_list vl2;
+	va_copy(vl2, vl);
+	const int chars = vsnprintf(NULL, 0, format, vl2);
+	va_end(vl2);
+	std::string s(chars, ' ');
+	vsnprintf(&s[0], chars + 1, format, vl);
+	return s;
+}
+
+std::string str_demangle(const char* str) {
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(str, NULL, NULL, &status);
+	if (!demangled) return str;
+	std::string result = demangled;
+	free(demangled);
+	return result;
+}
+std::string str_demangle(std::string str) {
+	return str_demangle(str.c_str());
+}
+
+size_t str_hash(const char* str) {
+	return std::hash<std::string>()(str);
+}
+lstring::Lexicon& lstring::Lexicon::instance() {
+	static Lexicon* self = new Lexicon;
+	return *self;
+}
+const char* lstring::Lexicon::intern(const char* ptr) {
+	if (!ptr || ptr[0] == '\0') return NULL;
+	Lexicon& self = instance();
+	std::lock_guard<std::mutex> l(self.mutex);
+	auto it = self.strings.find(ptr);
+	if (it == self.strings.end()) it = self.strings.insert(strdup(ptr)).first;
+	return *it;
+}
+
+void Report(string str) {
+	printf("%s\n", str.c_str());
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The game's Save.h declares the classes the mod calls into. Headless builds declare them in StdAfx.h.
+#include <game/StdAfx.h>
@@ -0,0 +1,86 @@
+#pragma once
+
+// Stands in for the game's precompiled header when the analysis code is built outside of Windows. The game's
+// own headers pull in the platform and OpenGL headers, so only what the analysis code uses is declared here.
+// None of the game functions declared here are called by a headless build, as there is no running game.
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+#define __printflike(a, b) __attribute__((format(printf, a, b)))
+#define DLLFACE
+#define NOEXCEPT noexcept
+
+// The game is 32-bit x86, where these calling conventions matter. They are never called through here.
+#define __thiscall
+#define __fastcall
+#define __cdecl
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::min;
+using std::max;
+
+#include <core/Str.h>
+
+void Report(string str);
+#define TYPE_NAME_S(X) str_demangle(typeid(X).name())
+
+#define DBG_TYPES(F)                 \
+	F(AI, uint64(1) << 3)            \
+	F(NOTIFICATION, uint64(1) << 26)
+
+#define TO_DBG_ENUM(X, V) DBG_##X = V,
+enum DebugRender : uint64 { DBG_TYPES(TO_DBG_ENUM) };
+
+// The game's EDebug is a SerialEnum, which needs the rest of the serialization code.
+struct EDebug {
+	uint64 value = 0;
+	EDebug() {}
+	EDebug(uint64 init) : value(init) {}
+	uint64 get() const { return value; }
+	bool operator==(uint64 o) const { return value == o; }
+	uint64 operator&(uint64 bits) const { return value & bits; }
+	uint64 operator&(EDebug bits) const { return value & bits.value; }
+	explicit operator bool() const { return value != 0; }
+};
+
+struct Notification;
+struct Notifier;
+struct Player;
+struct GameZone;
+
+struct CVarBase {
+	virtual ~CVarBase() {}
+	string getName() const { return name; }
+	string name;
+};
+template <typename T> struct CVar : public CVarBase {
+	T* m_vptr;
+};
+
+// Only the members the mod reads are declared. Their offsets in the game are those of its MSVC build, which
+// can't be reproduced here, so resolving `globals` headless finds the right instruction but applies the
+// offset of `player` in this layout. fixtures/make_synthetic.py lays out its image with the same offset.
+struct Globals {
+	EDebug debugRender;
+	Player* player;
+};
+static_assert(offsetof(Globals, player) == 8, "fixtures/make_synthetic.py expects globals at this offset");
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <internal/Utils.h>
+#include <internal/Analysis.h>
+#include <internal/ActionPool.h>
 
 #define DPRINT(TYPE, ARGS) aiModInternal::aiReportImpl(DBG_ ## TYPE, str_strip(str_format ARGS), false, false)
 
@@ -0,0 +1,70 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "ActionBatch.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <game/Blocks.h>
+
+namespace aiModInternal {
+#pragma region ActionBatchInputs
+	void ActionBatchInputs::clear() {
+		actions.clear();
+		ais.clear();
+		positions.clear();
+		velocities.clear();
+		targetPositions.clear();
+		hasTarget.clear();
+	}
+	void ActionBatchInputs::add(AIAction* action) {
+		auto ai = action->m_ai;
+		auto cluster = action->getCluster();
+		auto position = action->getClusterPos();
+		auto target = ai->getTarget();
+		actions.push_back(action);
+		ais.push_back(ai);
+		positions.push_back(position);
+		velocities.push_back(cluster ? cluster->getVel() : float2(0.f));
+		targetPositions.push_back(target ? ai->getTargetPos() : position);
+		hasTarget.push_back(target != NULL);
+	}
+#pragma endregion
+
+#pragma region ActionBatchCore
+	void ActionBatchCore::add(AIAction* action, size_t* memberIndex) {
+		*memberIndex = members.size();
+		members.push_back(action);
+		memberIndices.push_back(memberIndex);
+	}
+	void ActionBatchCore::remove(size_t memberIndex) {
+		// The last action takes the place of the removed one.
+		auto last = members.size() - 1;
+		members[memberIndex] = members[last];
+		memberIndices[memberIndex] = memberIndices[last];
+		*memberIndices[memberIndex] = memberIndex;
+		members.pop_back();
+		memberIndices.pop_back();
+	}
+
+	bool ActionBatchCore::gather(GameZone* zone) {
+		if (zone == this->zone && zone->simStep == simStep) return false;
+		this->zone = zone;
+		simStep = zone->simStep;
+
+		inputs.clear();
+		for (auto member : members)
+			if (member->m_ai->zone == zone) inputs.add(member);
+		return true;
+	}
+	const ActionBatchInputs& ActionBatchCore::gatherOne(size_t memberIndex) {
+		singleInputs.clear();
+		singleInputs.add(members[memberIndex]);
+		return singleInputs;
+	}
+	void ActionBatchCore::invalidate() {
+		zone = NULL;
+		generation++;
+	}
+#pragma endregion
+}
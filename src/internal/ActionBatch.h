@@ -0,0 +1,179 @@
+#pragma once
+
+#include <game/AI.h>
+#include <game/GameZone.h>
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace aiModInternal {
+	// The state of every AI running one batched action type in a game zone, as a struct of arrays. Index i of
+	// each array belongs to the same AI, so a batch kernel can stream over one field at a time.
+	struct ActionBatchInputs final {
+		std::vector<AIAction*> actions;
+		std::vector<AI*> ais;
+		std::vector<float2> positions;
+		std::vector<float2> velocities;
+		std::vector<float2> targetPositions; // From AI::getTargetPos, or the position if there's no target.
+		std::vector<uint8_t> hasTarget;
+
+		inline size_t size() const {
+			return ais.size();
+		}
+		void clear();
+		void add(AIAction* action);
+	};
+
+	// The live actions of one batched type, and the inputs gathered from them for the current step. This is
+	// the part of ActionBatch that doesn't depend on the action type.
+	struct ActionBatchCore {
+		std::mutex lock;
+		ActionBatchInputs inputs;
+		std::atomic<uint> generation{ 0 }; // Changed by invalidate, to outdate the outputs handed out before.
+
+		void add(AIAction* action, size_t* memberIndex);
+		void remove(size_t memberIndex);
+		// Gathers the inputs of every action in the zone, unless they were already gathered for its current
+		// step. Returns whether they were.
+		bool gather(GameZone* zone);
+		// Gathers a single action, for actions that missed the batch for this step.
+		const ActionBatchInputs& gatherOne(size_t memberIndex);
+		// Makes the next gather run even within the same step, e.g. to time it.
+		void invalidate();
+
+	private:
+		std::vector<AIAction*> members;
+		std::vector<size_t*> memberIndices; // Where each action keeps its index in members.
+		ActionBatchInputs singleInputs;
+		GameZone* zone = NULL;
+		uint simStep = 0;
+	};
+
+	// An action whose work is done for every AI running it at once. AIActionList::update still calls update on
+	// each action, one ship at a time, but the first call in a step of a game zone gathers the inputs of every
+	// action of this type in the zone and runs the batch kernel over all of them. Each call then only applies
+	// the result for its own AI, which keeps the lane logic per ship while the expensive part runs as one tight
+	// loop over packed data, instead of a virtual call and a cache miss for every ship. The batch is only locked
+	// to gather: the gather hands each action its output, stamped with the step, and the other calls of the step
+	// read it without locking. Actions are e.g.:
+	//
+	//     struct AOrbit final : public BatchedAction<AOrbit, float2> {
+	//         AOrbit(AI* ai) : BatchedAction(ai, LANE_MOVEMENT) { }
+	//         // Called once per step, with one output for each input.
+	//         static void updateBatch(const ActionBatchInputs& inputs, float2* outputs);
+	//         // Called by update with the output for this AI. Returns the lanes to block.
+	//         uint applyBatch(const float2& output, uint blockedLanes);
+	//     };
+	template <typename Derived, typename Output> struct BatchedAction : public AIAction {
+		BatchedAction(AI* ai, uint lanes, AIPriority priority = PRI_DEFAULT) : AIAction(ai, lanes, priority) {
+			auto& batch = getBatch();
+			std::lock_guard<std::mutex> guard(batch.core.lock);
+			batch.core.add(this, &memberIndex);
+		}
+		~BatchedAction() {
+			auto& batch = getBatch();
+			std::lock_guard<std::mutex> guard(batch.core.lock);
+			batch.core.remove(memberIndex);
+		}
+
+		uint update(uint blockedLanes) override final {
+			auto zone = m_ai->zone;
+			if (zone && hasOutput(zone)) return static_cast<Derived*>(this)->applyBatch(output, blockedLanes);
+
+			auto& batch = getBatch();
+			Output single;
+			{
+				std::lock_guard<std::mutex> guard(batch.core.lock);
+				auto& core = batch.core;
+				if (zone && core.gather(zone)) {
+					batch.outputs.resize(core.inputs.size());
+					Derived::updateBatch(core.inputs, batch.outputs.data());
+					for (size_t i = 0; i < core.inputs.size(); i++)
+						static_cast<BatchedAction*>(core.inputs.actions[i])->setOutput(zone, core.generation, batch.outputs[i]);
+				}
+				if (zone && hasOutput(zone)) return static_cast<Derived*>(this)->applyBatch(output, blockedLanes);
+
+				// Created after the batch ran in this step, or not in a zone, so it runs in a batch of its own.
+				batch.singleOutput.resize(1);
+				Derived::updateBatch(core.gatherOne(memberIndex), batch.singleOutput.data());
+				single = batch.singleOutput[0];
+			}
+			return static_cast<Derived*>(this)->applyBatch(single, blockedLanes);
+		}
+
+	protected:
+		// Gathers the inputs again on the next update, even within the same step, e.g. to time the gather.
+		static void invalidateBatch() {
+			auto& batch = getBatch();
+			std::lock_guard<std::mutex> guard(batch.core.lock);
+			batch.core.invalidate();
+		}
+
+	private:
+		static const uint kNoStep = ~0u;
+
+		struct Batch {
+			ActionBatchCore core;
+			std::vector<Output> outputs;
+			std::vector<Output> singleOutput;
+		};
+		static Batch& getBatch() {
+			static Batch batch;
+			return batch;
+		}
+
+		// Written by the gather under the batch lock, and published by the release store of outputStep.
+		inline void setOutput(GameZone* zone, uint generation, const Output& value) {
+			output = value;
+			outputZone = zone;
+			outputGeneration = generation;
+			outputStep.store(zone->simStep, std::memory_order_release);
+		}
+		inline bool hasOutput(GameZone* zone) const {
+			return outputStep.load(std::memory_order_acquire) == zone->simStep && outputZone == zone &&
+			       outputGeneration == getBatch().core.generation.load(std::memory_order_relaxed);
+		}
+
+		size_t memberIndex;
+		Output output;
+		GameZone* outputZone = NULL;
+		uint outputGeneration = 0;
+		std::atomic<uint> outputStep{ kNoStep };
+	};
+
+	// A batched action whose expensive part only reads the game, so it's evaluated for every AI running it on the
+	// thread pool. Each evaluation writes only its own result, and the results are committed one ship at a time on
+	// the update thread, in the order AIActionList::update reaches them. Every evaluation in a step sees the zone
+	// as it was before any result of the step was committed, so the results don't depend on the number of threads
+	// or on the order evaluations finish in, and replays stay the same. Actions are e.g.:
+	//
+	//     struct ATargetScore final : public ParallelAction<ATargetScore, Block*> {
+	//         ATargetScore(AI* ai) : ParallelAction(ai, LANE_TARGET) { }
+	//         // Runs on any thread. It must not change the game, the action or anything shared with other actions.
+	//         Block* evaluate(const ActionBatchInputs& inputs, size_t index) const;
+	//         // Called by update with the result for this AI, e.g. to call setTarget. Returns the lanes to block.
+	//         uint commit(Block* const& result, uint blockedLanes);
+	//     };
+	//
+	// Evaluation runs while the batch is locked, so it must not create or destroy actions of the same type.
+	template <typename Derived, typename Result> struct ParallelAction : public BatchedAction<Derived, Result> {
+		// Results are written concurrently, which std::vector<bool> can't do.
+		static_assert(!std::is_same<Result, bool>::value, "Use a uint8_t result instead of bool.");
+
+		ParallelAction(AI* ai, uint lanes, AIPriority priority = PRI_DEFAULT)
+		    : BatchedAction<Derived, Result>(ai, lanes, priority) { }
+
+		static void updateBatch(const ActionBatchInputs& inputs, Result* outputs) {
+			ThreadPool::instance().parallelFor(inputs.size(), [&](size_t i) {
+				outputs[i] = static_cast<const Derived*>(inputs.actions[i])->evaluate(inputs, i);
+			});
+		}
+		uint applyBatch(const Result& result, uint blockedLanes) {
+			return static_cast<Derived*>(this)->commit(result, blockedLanes);
+		}
+	};
+}
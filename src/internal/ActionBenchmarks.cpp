@@ -0,0 +1,118 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "Benchmarks.h"
+#include "ActionBatch.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <math.h>
+#include <memory>
+
+namespace aiModInternal {
+#pragma region Batched actions
+	static const size_t kBenchmarkShips = 1024;
+	static const int kBenchmarkSteps = 100;
+
+	// Heads for the target, leading it by the ship's velocity.
+	static float2 steer(float2 position, float2 velocity, float2 target) {
+		auto x = target.x - position.x - velocity.x, y = target.y - position.y - velocity.y;
+		auto length = sqrtf(x * x + y * y);
+		return length > 0.f ? float2(x / length, y / length) : float2(0.f);
+	}
+
+	// The same work as a BatchedAction::updateBatch kernel.
+	static void steerBatch(const ActionBatchInputs& inputs, float2* outputs) {
+		for (size_t i = 0; i < inputs.size(); i++)
+			outputs[i] = steer(inputs.positions[i], inputs.velocities[i], inputs.targetPositions[i]);
+	}
+
+	// A ship's state and its action, allocated on their own like the game's actions, which are updated through a
+	// virtual call each.
+	struct BenchmarkShip {
+		float2 position;
+		float2 velocity;
+		float2 target;
+		float2 output;
+
+		virtual ~BenchmarkShip() { }
+		virtual void update() {
+			output = steer(position, velocity, target);
+		}
+	};
+
+	// The same kernel as a real BatchedAction, so it goes through add, gather and the per-ship update.
+	struct BenchmarkBatchedAction final : public BatchedAction<BenchmarkBatchedAction, float2> {
+		BenchmarkBatchedAction(AI* ai) : BatchedAction(ai, LANE_NONE) { }
+		static void updateBatch(const ActionBatchInputs& inputs, float2* outputs) {
+			steerBatch(inputs, outputs);
+		}
+		uint applyBatch(const float2& output, uint blockedLanes) {
+			steering = output;
+			return LANE_NONE;
+		}
+		// Starts a new benchmark step, since the game's step doesn't advance while the benchmark runs.
+		static void nextStep() {
+			invalidateBatch();
+		}
+
+		float2 steering;
+	};
+
+	void runActionBenchmarks(AI* ai) {
+		DPRINT_LOW("Benchmarking actions for %d ships over %d steps, fastest of %d runs:", kBenchmarkShips,
+		           kBenchmarkSteps, kBenchmarkRuns);
+		std::vector<std::unique_ptr<BenchmarkShip>> ships;
+		ActionBatchInputs inputs;
+		for (size_t i = 0; i < kBenchmarkShips; i++) {
+			auto ship = std::make_unique<BenchmarkShip>();
+			ship->position = float2((float) (i % 64) * 100.f, (float) (i / 64) * 100.f);
+			ship->velocity = float2((float) (i % 7) - 3.f, (float) (i % 5) - 2.f);
+			ship->target = float2(3200.f, 3200.f);
+			inputs.actions.push_back(NULL);
+			inputs.ais.push_back(NULL);
+			inputs.positions.push_back(ship->position);
+			inputs.velocities.push_back(ship->velocity);
+			inputs.targetPositions.push_back(ship->target);
+			inputs.hasTarget.push_back(1);
+			ships.push_back(std::move(ship));
+		}
+		// Shuffle the ships the way allocation order drifts from update order in a long game.
+		for (size_t i = ships.size() - 1; i > 0; i--) std::swap(ships[i], ships[(i * 2654435761u) % (i + 1)]);
+
+		std::vector<float2> outputs(kBenchmarkShips);
+		auto perShipTime = timeBest([&]() {
+			for (int step = 0; step < kBenchmarkSteps; step++)
+				for (auto& ship : ships) ship->update();
+		});
+		auto batchedTime = timeBest([&]() {
+			for (int step = 0; step < kBenchmarkSteps; step++) steerBatch(inputs, outputs.data());
+		});
+
+		float perShipSum = 0.f, batchedSum = 0.f;
+		for (auto& ship : ships) perShipSum += ship->output.x + ship->output.y;
+		for (auto& output : outputs) batchedSum += output.x + output.y;
+		DPRINT_LOW("  %-40s %10.2f ms %10.2f sum", "Per ship, virtual update", perShipTime / 1000.0, perShipSum);
+		DPRINT_LOW("  %-40s %10.2f ms %10.2f sum", "Batched over ActionBatchInputs", batchedTime / 1000.0, batchedSum);
+
+		// Every member belongs to the same AI, so they gather the same inputs, but the calls are the real ones.
+		if (!ai->zone) DPRINT_LOW("  The AI isn't in a zone, so each BatchedAction update runs in a batch of its own.");
+		std::vector<std::unique_ptr<BenchmarkBatchedAction>> actions;
+		auto createTime = timeBest([&]() {
+			actions.clear();
+			for (size_t i = 0; i < kBenchmarkShips; i++) actions.push_back(std::make_unique<BenchmarkBatchedAction>(ai));
+		});
+		auto updateTime = timeBest([&]() {
+			for (int step = 0; step < kBenchmarkSteps; step++) {
+				BenchmarkBatchedAction::nextStep();
+				for (auto& action : actions) action->update(AIAction::LANE_NONE);
+			}
+		});
+
+		float actionSum = 0.f;
+		for (auto& action : actions) actionSum += action->steering.x + action->steering.y;
+		DPRINT_LOW("  %-40s %10.2f ms", "BatchedAction, create and destroy", createTime / 1000.0);
+		DPRINT_LOW("  %-40s %10.2f ms %10.2f sum", "BatchedAction, gather and update", updateTime / 1000.0, actionSum);
+	}
+#pragma endregion
+}
\ No newline at end of file
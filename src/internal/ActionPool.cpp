@@ -0,0 +1,92 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "ActionPool.h"
+#include "Macros.h"
+#include "Utils.h"
+
+namespace aiModInternal {
+#pragma region ActionPool
+	ActionPool& ActionPool::instance() {
+		static ActionPool pool;
+		return pool;
+	}
+
+	void ActionPool::addSlab(size_t sizeClass) {
+		auto blockSize = (sizeClass + 1) * kSizeClass;
+		auto slab = (uint8_t*) ::operator new(kSlabSize);
+		slabs.push_back(slab);
+		stats.slabs++;
+		stats.heapAllocations++;
+		stats.heapBytes += kSlabSize;
+
+		// Blocks are linked in address order, so a new slab is handed out front to back.
+		auto count = kSlabSize / blockSize;
+		for (auto i = count; i-- > 0;) {
+			auto block = (FreeBlock*) (slab + i * blockSize);
+			block->next = freeLists[sizeClass];
+			freeLists[sizeClass] = block;
+		}
+		stats.freeBlocks += count;
+	}
+
+	void* ActionPool::allocate(size_t size) {
+		std::lock_guard<std::mutex> guard(lock);
+		stats.allocations++;
+		stats.liveBlocks++;
+		if (size == 0 || size > kMaxBlockSize) {
+			stats.heapAllocations++;
+			stats.heapBytes += size;
+			return ::operator new(size);
+		}
+
+		auto sizeClass = (size - 1) / kSizeClass;
+		if (!freeLists[sizeClass]) addSlab(sizeClass);
+		auto block = freeLists[sizeClass];
+		freeLists[sizeClass] = block->next;
+		stats.freeBlocks--;
+		return block;
+	}
+	void ActionPool::deallocate(void* block, size_t size) {
+		if (!block) return;
+		std::lock_guard<std::mutex> guard(lock);
+		stats.deallocations++;
+		stats.liveBlocks--;
+		if (size == 0 || size > kMaxBlockSize) {
+			::operator delete(block);
+			return;
+		}
+
+		auto sizeClass = (size - 1) / kSizeClass;
+		auto free = (FreeBlock*) block;
+		free->next = freeLists[sizeClass];
+		freeLists[sizeClass] = free;
+		stats.freeBlocks++;
+	}
+
+	bool ActionPool::releaseUnused() {
+		std::lock_guard<std::mutex> guard(lock);
+		if (stats.liveBlocks != 0) {
+			DPRINT_LOW("Keeping the action pool, as %d actions are still alive.", stats.liveBlocks);
+			return false;
+		}
+		for (auto slab : slabs) ::operator delete(slab);
+		slabs.clear();
+		for (auto& list : freeLists) list = NULL;
+		stats.freeBlocks = 0;
+		stats.slabs = 0;
+		return true;
+	}
+
+	ActionPoolStats ActionPool::getStats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return stats;
+	}
+	void ActionPool::logStats() {
+		auto stats = getStats();
+		DPRINT_LOW("Action pool: %llu allocations, %llu deallocations, %llu heap allocations (%llu KB).",
+		           stats.allocations, stats.deallocations, stats.heapAllocations, stats.heapBytes / 1024);
+		DPRINT_LOW("  %d live blocks, %d free blocks in %d slabs.", stats.liveBlocks, stats.freeBlocks, stats.slabs);
+	}
+#pragma endregion
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <core/Str.h>
+
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace aiModInternal {
+	struct ActionPoolStats final {
+		uint64_t allocations = 0;
+		uint64_t deallocations = 0;
+		// Allocations that went to the heap: new slabs, and blocks too big for a size class.
+		uint64_t heapAllocations = 0;
+		uint64_t heapBytes = 0;
+		size_t liveBlocks = 0;
+		size_t freeBlocks = 0;
+		size_t slabs = 0;
+	};
+
+	// Fixed size blocks for the AIAction objects created by the mod. The game deletes actions one at a time
+	// from AIActionList::clear() whenever an AI's config changes, so blocks are returned to a free list for their
+	// size class rather than to the heap. Once every size class has been used, recreating actions doesn't
+	// allocate at all.
+	//
+	// Blocks are carved from 64 KB slabs, which are only freed by releaseUnused. Blocks are aligned like
+	// ::operator new, and sizes over kMaxBlockSize are passed through to the heap.
+	struct ActionPool final {
+		static const size_t kSizeClass = 16;
+		static const size_t kMaxBlockSize = 1024;
+		static const size_t kSlabSize = 64 * 1024;
+
+		static ActionPool& instance();
+
+		void* allocate(size_t size);
+		void deallocate(void* block, size_t size);
+
+		// Frees every slab back to the heap if no block is in use, e.g. between game zones. Returns false and
+		// keeps the slabs otherwise.
+		bool releaseUnused();
+
+		ActionPoolStats getStats();
+		void logStats();
+
+	private:
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+
+		std::mutex lock;
+		FreeBlock* freeLists[kMaxBlockSize / kSizeClass] = { NULL };
+		std::vector<void*> slabs;
+		ActionPoolStats stats;
+
+		ActionPool() { }
+		void addSlab(size_t sizeClass);
+	};
+
+	// Constructs an action in the action pool, e.g. `ai->addAction(createPooledAction<AFoo>(ai))`. The action has
+	// to use the pool for its operator delete as well, since the game deletes it, so it must use USE_ACTION_POOL.
+	template <typename T, typename... Args> T* createPooledAction(Args&&... args) {
+		static_assert(T::kUsesActionPool, "Actions created in the pool must use USE_ACTION_POOL.");
+		auto block = ActionPool::instance().allocate(sizeof(T));
+		return ::new (block) T(std::forward<Args>(args)...);
+	}
+}
+
+// Allocates an AIAction subclass from the action pool, both when the mod creates it with new or
+// createPooledAction and when the game deletes it. Place this in the body of the class.
+#define USE_ACTION_POOL \
+	static const bool kUsesActionPool = true; \
+	static void* operator new(size_t size) { return ::aiModInternal::ActionPool::instance().allocate(size); } \
+	static void operator delete(void* block, size_t size) { ::aiModInternal::ActionPool::instance().deallocate(block, size); }
@@ -0,0 +1,128 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "ActionScheduler.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace aiModInternal {
+#pragma region ActionScheduler
+	ActionScheduler& ActionScheduler::instance() {
+		static ActionScheduler scheduler;
+		return scheduler;
+	}
+
+	void ActionScheduler::setBudget(uint units) {
+		std::lock_guard<std::mutex> guard(lock);
+		budget = units;
+	}
+
+	void ActionScheduler::startStep(GameZone* zone) {
+		if (this->zone && spent > budget) stats.overBudgetSteps++;
+		if (zone != this->zone) deferred.clear();
+		this->zone = zone;
+		simStep = zone->simStep;
+		spent = 0;
+
+		queue.clear();
+		for (auto it = deferred.begin(); it != deferred.end();) {
+			if (simStep - it->second.lastSeen > kMaxMissedSteps) {
+				it = deferred.erase(it);
+				continue;
+			}
+			queue.push_back(it->second);
+			++it;
+		}
+
+		// Set budget aside for the oldest deferred actions, up to the step that fills it. The oldest always fits.
+		std::sort(queue.begin(), queue.end(), [](const Deferral& a, const Deferral& b) { return a.dueSince < b.dueSince; });
+		cutoff = 0;
+		reserved = 0;
+		for (auto& deferral : queue) {
+			if (reserved && reserved + deferral.units > budget) break;
+			cutoff = deferral.dueSince;
+			reserved += deferral.units;
+		}
+	}
+
+	bool ActionScheduler::begin(const AIAction* action, ActionCost cost, float period, bool isNew) {
+		auto zone = action->m_ai->zone;
+		if (!zone) return true;
+		std::lock_guard<std::mutex> guard(lock);
+		if (zone != this->zone || zone->simStep != simStep) startStep(zone);
+
+		auto deferral = deferred.find(action);
+		auto isDeferred = deferral != deferred.end();
+		if (!isNew && !isDeferred && !zone->isUpdateStep(action, period)) return false;
+		if (cost == ActionCost::Cheap) {
+			stats.runs++;
+			return true;
+		}
+
+		auto units = costUnits(cost);
+		if (isDeferred) {
+			// Deferred actions use the budget set aside for them, oldest first.
+			deferral->second.lastSeen = simStep;
+			if (deferral->second.dueSince > cutoff || (spent && spent + units > budget)) {
+				stats.deferrals++;
+				return false;
+			}
+			stats.longestDeferral = std::max(stats.longestDeferral, simStep - deferral->second.dueSince);
+			deferred.erase(deferral);
+			reserved -= std::min(reserved, units);
+		} else if (spent && spent + reserved + units > budget) {
+			deferred[action] = { simStep, simStep, units };
+			stats.deferrals++;
+			return false;
+		}
+		spent += units;
+		stats.runs++;
+		return true;
+	}
+	void ActionScheduler::finish(uint64_t microseconds) {
+		std::lock_guard<std::mutex> guard(lock);
+		stats.microseconds += microseconds;
+	}
+	void ActionScheduler::forget(const AIAction* action) {
+		std::lock_guard<std::mutex> guard(lock);
+		deferred.erase(action);
+	}
+
+	ActionSchedulerStats ActionScheduler::getStats() {
+		std::lock_guard<std::mutex> guard(lock);
+		auto result = stats;
+		result.deferredActions = deferred.size();
+		return result;
+	}
+	void ActionScheduler::logStats() {
+		auto stats = getStats();
+		DPRINT_LOW("Action scheduler: %llu runs, %llu deferrals, %llu ms in expensive actions.", stats.runs,
+		           stats.deferrals, stats.microseconds / 1000);
+		DPRINT_LOW("  %llu steps over budget, %d actions deferred, longest deferral %d steps.", stats.overBudgetSteps,
+		           stats.deferredActions, stats.longestDeferral);
+	}
+#pragma endregion
+
+#pragma region ScheduledAction
+	ScheduledAction::~ScheduledAction() {
+		ActionScheduler::instance().forget(this);
+	}
+
+	uint ScheduledAction::update(uint blockedLanes) {
+		auto& scheduler = ActionScheduler::instance();
+		if (!scheduler.begin(this, cost, period, !hasRun)) return skippedUpdate(blockedLanes);
+		hasRun = true;
+		if (cost == ActionCost::Cheap) return lastBlockedLanes = scheduledUpdate(blockedLanes);
+
+		// Timed for the stats only. Scheduling on time would make replays depend on the machine.
+		auto start = std::chrono::steady_clock::now();
+		lastBlockedLanes = scheduledUpdate(blockedLanes);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		scheduler.finish(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+		return lastBlockedLanes;
+	}
+#pragma endregion
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <game/AI.h>
+#include <game/GameZone.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace aiModInternal {
+	enum class ActionCost : uint8_t {
+		Cheap, // Runs whenever it's due, and isn't counted against the budget.
+		Expensive, // Pathfinding, target search and the like, which are counted against the budget.
+	};
+	// The share of the budget an update of each cost takes.
+	inline uint costUnits(ActionCost cost) {
+		static const uint units[] = { 0, 1 };
+		return units[(size_t) cost];
+	}
+
+	struct ActionSchedulerStats final {
+		uint64_t runs = 0;
+		uint64_t deferrals = 0; // Steps in which a due expensive action was deferred.
+		uint64_t microseconds = 0; // Spent in expensive actions. Only measured, never used to schedule.
+		uint64_t overBudgetSteps = 0;
+		uint longestDeferral = 0; // In steps.
+		size_t deferredActions = 0;
+	};
+
+	// Spreads the updates of mod actions over steps, and limits how many expensive actions run in each step.
+	// An action runs every `period` seconds of game time, at a phase picked from its address by
+	// GameZone::isUpdateStep, so a fleet that spawns at once doesn't update at once. The budget is counted in
+	// costUnits rather than time, so the same actions run in the same steps on any machine and replays stay in
+	// sync. An expensive action that is due once the budget for the step is spent is deferred, and stays due in
+	// later steps until it runs. Deferred actions are queued by the step they became due in: at the start of each
+	// step, budget is set aside for as many of the oldest as fit, and the rest of the queue and the actions that
+	// have just become due wait for it. When AIs need more than the budget, they run less often rather than all
+	// at once.
+	struct ActionScheduler final {
+		static const uint kDefaultBudgetUnits = 16;
+		// A deferred action that isn't updated for this many steps was blocked by another action or left its
+		// action list, and is dropped from the queue.
+		static const uint kMaxMissedSteps = 8;
+
+		static ActionScheduler& instance();
+
+		void setBudget(uint units);
+
+		// Whether an action should run in this step. New actions are due right away. Each call that returns
+		// true for an expensive action must be followed by a call to finish. At least one expensive action runs
+		// in each step, however small the budget.
+		bool begin(const AIAction* action, ActionCost cost, float period, bool isNew);
+		// Records how long an expensive action took, for the stats.
+		void finish(uint64_t microseconds);
+		// Drops a destroyed action from the deferral queue.
+		void forget(const AIAction* action);
+
+		ActionSchedulerStats getStats();
+		void logStats();
+
+	private:
+		struct Deferral {
+			uint dueSince;
+			uint lastSeen;
+			uint units;
+		};
+
+		std::mutex lock;
+		uint budget = kDefaultBudgetUnits;
+		uint spent = 0;
+		uint reserved = 0; // Set aside for the deferred actions that may run in this step.
+		uint cutoff = 0; // Deferred actions due since this step or earlier may run in this step.
+		std::unordered_map<const AIAction*, Deferral> deferred;
+		std::vector<Deferral> queue;
+		ActionSchedulerStats stats;
+		GameZone* zone = NULL;
+		uint simStep = 0;
+
+		ActionScheduler() { }
+		void startStep(GameZone* zone);
+	};
+
+	// An action updated by the ActionScheduler, e.g.:
+	//
+	//     struct APathfind final : public ScheduledAction {
+	//         APathfind(AI* ai) : ScheduledAction(ai, LANE_MOVEMENT, ActionCost::Expensive, kAIBigTimeStep) { }
+	//         // Called when the scheduler runs the action. Returns the lanes to block.
+	//         uint scheduledUpdate(uint blockedLanes) override;
+	//     };
+	//
+	// In the steps it doesn't run, the action blocks the lanes its last run blocked, so lower priority actions
+	// don't take them over while it waits for its turn.
+	struct ScheduledAction : public AIAction {
+		ScheduledAction(AI* ai, uint lanes, ActionCost cost, float period, AIPriority priority = PRI_DEFAULT)
+		    : AIAction(ai, lanes, priority), cost(cost), period(period) { }
+		~ScheduledAction();
+
+		uint update(uint blockedLanes) override final;
+		virtual uint scheduledUpdate(uint blockedLanes) = 0;
+		// Called instead of scheduledUpdate in the steps the action doesn't run.
+		virtual uint skippedUpdate(uint blockedLanes) {
+			return lastBlockedLanes;
+		}
+
+	private:
+		const ActionCost cost;
+		const float period;
+		bool hasRun = false;
+		uint lastBlockedLanes = LANE_NONE;
+	};
+}
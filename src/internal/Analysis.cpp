@@ -1,261 +1,308 @@
 #include <game/StdAfx.h>
 #include <game/Save.h>
 #include "Analysis.h"
+#include "AnalysisCache.h"
 #include "AnalysisCore.h"
+#include "AnalysisStats.h"
+#include "DisassemblyLog.h"
+#include "Signature.h"
 #include "Utils.h"
 #include "Macros.h"
 
-#include <psapi.h>
+#include <chrono>
 #include <stdio.h>
-#include <unordered_set>
+#include <stdlib.h>
+#include <thread>
 
 using namespace std::literals;
 
 namespace aiModInternal {
 	static PEModule& getReassemblyModule() {
+#ifdef _WIN32
 		static PEModule module = PEModule(GetModuleHandle(NULL));
 		return module;
+#else
+		reportFatalError("The running game can only be analyzed on Windows.");
+#endif
+	}
+	static AnalysisCache& getAnalysisCache() {
+		static AnalysisCache cache(getReassemblyModule(), str_format("%s.cache", getSelfModulePath()));
+		return cache;
 	}
 
-#pragma region Notifier::instance, Notifier::notify
-	struct NotifierOffsets {
-		Notifier& (*Notifier_instance)() = NULL;
-		void(__thiscall *Notifier_notify)(Notifier*, const Notification&) = NULL;
+	// Signatures are built on first use rather than during static initialization, as other translation units
+	// resolve offsets from their own static initializers.
+	struct Signatures {
+		Signature notifierInstance;
+		Signature notifierNotify;
+		Signature globalsOffset;
+		Signature playerSetMessage;
+		Signature cvarBaseIndex;
+
+		std::vector<std::pair<const char*, Signature>> named() const {
+			return {
+				{ "Notifier::instance", notifierInstance },
+				{ "Notifier::notify", notifierNotify },
+				{ "globals", globalsOffset },
+				{ "Player::setMessage", playerSetMessage },
+				{ "CVarBase::index", cvarBaseIndex },
+			};
+		}
+		std::vector<Signature> all() const {
+			std::vector<Signature> signatures;
+			for (auto& pair : named()) signatures.push_back(pair.second);
+			return signatures;
+		}
 	};
-	static std::optional<NotifierOffsets> findNotifierOffsets() {
-		auto mod = getReassemblyModule();
-		auto rdata = mod.getSegment(".rdata");
-		auto text = mod.getSegment(".text");
+	static std::optional<Offset> isCmpMemZero(const DecodedInstruction& instr) {
+		if (instr.opcode != ZYDIS_MNEMONIC_CMP) return std::nullopt;
+		if (instr.totalOperandCount != 3) return std::nullopt;
+		if (instr.operands[1].type != ZYDIS_OPERAND_TYPE_IMMEDIATE) return std::nullopt;
+		if (instr.operands[1].value != 0) return std::nullopt;
+		return instr.operands[0].absoluteAddress();
+	}
+	static Signatures createSignatures() {
+		Signatures sigs;
 
-		DPRINT_LOW("Searching for Notifier offsets...");
-		NotifierOffsets offsets;
+		// Notifier::notify is the function containing part of its assert string, and is called from
+		// Block::addResource. The potential entries are tried in order, and the first one that Block::addResource
+		// calls after another call is taken. Notifier::instance returns the `this` it's called with.
+		auto addResource = Signature::fromExport("?addResource@Block@@QAEMMU?$tvec2@M$0A@@glm@@@Z");
+		auto notifyEntries = Signature::fromString("Notifier::notify\0"s, ".rdata").only().refsIn(".text").entries(0x200);
+		sigs.notifierNotify = addResource.callsMatching(notifyEntries, 0, 1);
+		sigs.notifierInstance = addResource.passedTo(sigs.notifierNotify, Signature::kThisArgument).only();
 
-		// Find part of an assert string in Notifier::notifier
-		auto notifyStringOffset = rdata.findOnlyString("Notifier::notify\0"s);
-		ANALYSIS_TRY(notifyStringOffset);
-		ANALYSIS_DBG("0x%p", *notifyStringOffset);
-		// Find potential function entry points containing a references to that string
-		auto notifyPotentialEntries = text.findPotentialFunctionEntriesByOffset(*notifyStringOffset, 0x200);
-		ANALYSIS_DBG_LIST("0x%p", notifyPotentialEntries);
-		// Find a call to one of those potential entries in Block::addResource
-		auto notifyFunction = mod.parseFunctionByName("?addResource@Block@@QAEMMU?$tvec2@M$0A@@glm@@@Z");
-		ANALYSIS_TRY(notifyFunction);
-		auto notifyCallOffsets = notifyFunction->getCallOffsets();
-			
-		for (auto offset : notifyPotentialEntries) {
-			auto begin = notifyCallOffsets.begin();
-			auto end = notifyCallOffsets.end();
-			auto firstOccurance = std::find(begin, end, offset);
-			if (firstOccurance == begin) continue;
-			if (firstOccurance == end) continue;
-			offsets.Notifier_instance = (Notifier& (*)()) *(firstOccurance - 1);
-			offsets.Notifier_notify = (void(__thiscall *)(Notifier*, const Notification&)) *firstOccurance;
-			ANALYSIS_DBG("0x%p", offsets.Notifier_instance);
-			ANALYSIS_DBG("0x%p", offsets.Notifier_notify);
-			return offsets;
+		// Block::launchUpdate contains a `cmp globals.player, 0` instruction.
+		sigs.globalsOffset = Signature::fromExport("?launchUpdate@Block@@AAE_NI@Z")
+			.matchInstruction(isCmpMemZero, "`CMP mem32, 0` instruction").only()
+			.offset(-(ptrdiff_t) offsetof(Globals, player));
+
+		// The "Unlocked Faction" text is passed to `gettext_`, `string::string` and then `Player::setMessage`, so
+		// the third call after the first reference whose first call is `gettext_` is taken.
+		sigs.playerSetMessage = Signature::fromString("Unlocked Faction\0"s, ".rdata").only().refsIn(".text").offset(-1)
+			.firstCallTo(Signature::fromExport("?gettext_@@YAPBDPBD@Z")).callAt(2).first();
+
+		// The CVarBase constructor references the CVarBase vftable, and is called after the "kBlockOverlap" string
+		// is referenced. The first potential constructor that is called there is taken, and the second of its
+		// three calls is CVarBase::index.
+		auto cvarBaseVftable = Signature::fromVftable("CVarBase");
+		auto kBlockOverlapSetup = Signature::fromString("kBlockOverlap\0"s, ".rdata").only().refsIn(".text").only().offset(4);
+		sigs.cvarBaseIndex = cvarBaseVftable.refsIn(".text").entries(0x200).calledFrom(kBlockOverlapSetup).first()
+			.callAt(1, 3);
+
+		return sigs;
+	}
+	static const Signatures& getSignatures() {
+		static auto sigs = createSignatures();
+		return sigs;
+	}
+	// Signatures that fail dump disassembly to the log named by AI_MOD_DISASSEMBLY_LOG, if it is set.
+	static void openDisassemblyLog() {
+		static bool opened = []() {
+			auto path = getenv("AI_MOD_DISASSEMBLY_LOG");
+			return path && *path && DisassemblyLog::instance().open(path);
+		}();
+		(void) opened;
+	}
+	// Stage stats are written to the file named by AI_MOD_ANALYSIS_STATS, if it is set, once analysis is done.
+	static void saveAnalysisStats() {
+		auto path = getenv("AI_MOD_ANALYSIS_STATS");
+		if (path && *path) AnalysisStats::instance().save(path);
+	}
+	static SignatureEngine& getSignatureEngine() {
+		openDisassemblyLog();
+		static SignatureEngine engine(getReassemblyModule(), getSignatures().all());
+		return engine;
+	}
+
+	std::map<string, ResolvedOffset> resolveAllOffsets(const PEModule& module) {
+		openDisassemblyLog();
+		auto& sigs = getSignatures();
+		SignatureEngine engine(module, sigs.all());
+		std::map<string, ResolvedOffset> results;
+		for (auto& pair : sigs.named()) {
+			auto memoryBefore = getProcessMemoryUsage();
+			auto start = std::chrono::steady_clock::now();
+			auto offset = engine.resolve(pair.first, pair.second);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+
+			auto& result = results[pair.first];
+			if (offset.has_value()) result.rva = module.rva(*offset);
+			result.microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+			result.memoryBytes = (int64_t) getProcessMemoryUsage() - (int64_t) memoryBefore;
+		}
+		AnalysisStats::instance().logTable();
+		saveAnalysisStats();
+		return results;
+	}
+
+	// Resolves a signature, unless its offset is already in the analysis cache.
+	static std::optional<Offset> resolveCached(const char* key, CachedOffsetKind kind, const Signature& signature) {
+		auto& cache = getAnalysisCache();
+		{
+			AnalysisStage stage("AnalysisCache");
+			auto cached = cache.tryGet(key);
+			if (cached.has_value()) {
+				stage.produced(1);
+				return cached;
+			}
+			stage.rejected(1);
 		}
 
-		DPRINT_LOW("  Could not find call to any Notify::notify possibilities.");
-		return std::nullopt;
+		auto& engine = getSignatureEngine();
+		auto offset = engine.resolve(key, signature);
+		if (!offset.has_value()) return offset;
+		// The cache checks an offset against the instruction it was found from, so one without isn't cached.
+		auto origin = engine.findOrigin(*offset);
+		if (origin.has_value()) cache.put(key, kind, *offset, origin->instruction, origin->address);
+		else DPRINT_LOW("  %s wasn't found from an instruction, so it isn't cached.", key);
+		return offset;
+	}
+
+#pragma region Notifier::instance, Notifier::notify
+	typedef Notifier& (*fn_Notifier_instance)();
+	typedef void (__fastcall *fn_Notifier_notify)(Notifier*, void*, const Notification&);
+	struct NotifierOffsets {
+		fn_Notifier_instance Notifier_instance = NULL;
+		fn_Notifier_notify Notifier_notify = NULL;
+	};
+	static std::optional<NotifierOffsets> loadNotifierOffsets() {
+		auto& sigs = getSignatures();
+		auto instance = resolveCached("Notifier::instance", CachedOffsetKind::Function, sigs.notifierInstance);
+		ANALYSIS_TRY(instance);
+		auto notify = resolveCached("Notifier::notify", CachedOffsetKind::Function, sigs.notifierNotify);
+		ANALYSIS_TRY(notify);
+
+		NotifierOffsets offsets;
+		offsets.Notifier_instance = (fn_Notifier_instance) *instance;
+		offsets.Notifier_notify = (fn_Notifier_notify) *notify;
+		return offsets;
 	}
 	static std::optional<NotifierOffsets>& getNotifierOffsets() {
-		static auto offsets = findNotifierOffsets();
+		static auto offsets = loadNotifierOffsets();
 		return offsets;
 	}
 	bool notifierOffsetsLoaded() {
 		return getNotifierOffsets().has_value();
 	}
-	Notifier& Notifier_instance() {
-		auto offsets = getNotifierOffsets();
+	static Notifier& resolveNotifier_instance() {
+		auto& offsets = getNotifierOffsets();
 		if (!offsets.has_value()) reportFatalError("Failed to find Notifier::instance offset.");
+		dispatchTable.Notifier_instance.store(offsets->Notifier_instance, std::memory_order_relaxed);
 		return offsets->Notifier_instance();
 	}
-	void Notifier_notify(Notifier* notifier, const Notification& notification) {
-		auto offsets = getNotifierOffsets();
+	// Has the __fastcall signature of the DispatchTable slot, which the game's __thiscall function is called as.
+	static void __fastcall resolveNotifier_notify(Notifier* notifier, void*, const Notification& notification) {
+		auto& offsets = getNotifierOffsets();
 		if (!offsets.has_value()) reportFatalError("Failed to find Notifier::notify offset.");
-		offsets->Notifier_notify(notifier, notification);
+		dispatchTable.Notifier_notify.store(offsets->Notifier_notify, std::memory_order_relaxed);
+		offsets->Notifier_notify(notifier, NULL, notification);
 	}
 #pragma endregion
 #pragma region globals
-	static std::optional<Globals*> findGlobals() {
-		auto mod = getReassemblyModule();
-
-		DPRINT_LOW("Searching for globals offset...");
-
-		auto func = mod.parseFunctionByName("?launchUpdate@Block@@AAE_NI@Z");
-		ANALYSIS_TRY(func);
-
-		// Find a `cmp globals.player, 0` instruction in Block::launchUpdate
-		auto playerOffset = func->findOnlyInstruction<Offset>([](const DecodedInstruction& instr) -> std::optional<Offset> {
-			if (instr.opcode == ZYDIS_MNEMONIC_CMP) {
-				auto decoded = instr.decode();
-				if (decoded.operandCount != 3) return std::nullopt;
-				if (decoded.operands[1].type != ZYDIS_OPERAND_TYPE_IMMEDIATE) return std::nullopt;
-				if (decoded.operands[1].imm.value.u != 0) return std::nullopt;
-				ZydisU64 offset;
-				auto status = ZydisCalcAbsoluteAddress(&decoded, &decoded.operands[0], &offset);
-				if (!ZYDIS_SUCCESS(status)) return std::nullopt;
-				return (Offset) offset;
-			}
-			return std::nullopt;
-		}, "`CMP mem32, 0` instruction");
-		if (!playerOffset.has_value()) {
+	static std::optional<Globals*> loadGlobals() {
+		auto offset = resolveCached("globals", CachedOffsetKind::Data, getSignatures().globalsOffset);
+		if (!offset.has_value()) {
 			DPRINT_LOW_REPORT("Warning: Failed to find globals offset.");
 			return std::nullopt;
 		}
-		ANALYSIS_DBG("0x%p", *playerOffset);
-		auto globalsOffset = *playerOffset - offsetof(Globals, player);
-		ANALYSIS_DBG("0x%p", globalsOffset);
-		return (Globals*) globalsOffset;
+		return (Globals*) *offset;
 	}
 	std::optional<Globals*> tryGetGlobals() {
-		static auto globals = findGlobals();
-		return globals;
+		static auto offset = loadGlobals();
+		return offset;
 	}
 	Globals& getGlobals() {
-		auto globals = tryGetGlobals();
-		if (!globals.has_value()) reportFatalError("Failed to find globals offset.");
-		return (Globals&) *globals;
+		auto offset = tryGetGlobals();
+		if (!offset.has_value()) reportFatalError("Failed to find globals offset.");
+		return **offset;
 	}
 #pragma endregion
 #pragma region Player::setMessage
-	typedef void (__thiscall *fn_Player_setMessage)(Player*, string msg);
-	static std::optional<fn_Player_setMessage> findPlayerSetMessage() {
-		auto mod = getReassemblyModule();
-		auto rdata = mod.getSegment(".rdata");
-		auto text = mod.getSegment(".text");
-
-		DPRINT_LOW("Searching for Player::setMessage offset...");
-
-		// Find the "Unlocked Faction" text.
-		auto unlockedFactionStringOffset = rdata.findOnlyString("Unlocked Faction\0"s);
-		ANALYSIS_TRY(unlockedFactionStringOffset);
-		ANALYSIS_DBG("0x%p", *unlockedFactionStringOffset);
-		// Find all references to the "Unlocked Faction" text.
-		auto unlockedFactionOffsets = text.findOffset(*unlockedFactionStringOffset);
-		ANALYSIS_DBG_LIST("0x%p", unlockedFactionOffsets);
-		auto getTextOffset = mod.getFunctionByName("?gettext_@@YAPBDPBD@Z");
-		for (auto offset : unlockedFactionOffsets) {
-			auto func = mod.parseFunctionByOffset(offset - 1);
-			if (!func.has_value()) continue;
-			auto calls = func->getCallOffsets(offset - 1);
-			ANALYSIS_DBG_LIST("0x%p", calls);
-			if (calls.size() < 3) continue;
-			// Calls in order should be `gettext_`, `string::string`, `Player::setMessage`
-			if (calls[0] != getTextOffset) continue;
-			ANALYSIS_DBG("0x%p", calls[2]);
-			return (fn_Player_setMessage) calls[2];
-		}
-
-		DPRINT_LOW("  Could not find call to Player::setMessage.");
-		return std::nullopt;
+	typedef void (__fastcall *fn_Player_setMessage)(Player*, void*, string msg);
+	static std::optional<fn_Player_setMessage> loadPlayerSetMessage() {
+		auto offset = resolveCached("Player::setMessage", CachedOffsetKind::Function, getSignatures().playerSetMessage);
+		ANALYSIS_TRY(offset);
+		return (fn_Player_setMessage) *offset;
 	}
-	static std::optional<fn_Player_setMessage> getPlayer_setMessage() {
-		static auto func = findPlayerSetMessage();
+	static const std::optional<fn_Player_setMessage>& getPlayer_setMessage() {
+		static auto func = loadPlayerSetMessage();
 		return func;
 	}
 	bool playerSetMessageLoaded() {
 		return getPlayer_setMessage().has_value();
 	}
-	void Player_setMessage(Player* player, string msg) {
-		auto func = getPlayer_setMessage();
+	static void __fastcall resolvePlayer_setMessage(Player* player, void*, string msg) {
+		auto& func = getPlayer_setMessage();
 		if (!func.has_value()) reportFatalError("Failed to find Player::setMessage offset.");
-		(*func)(player, msg);
+		dispatchTable.Player_setMessage.store(*func, std::memory_order_relaxed);
+		(*func)(player, NULL, std::move(msg));
 	}
 #pragma endregion
 #pragma region CVarBase::index
 	typedef std::map<lstring, CVarBase*>& (*fn_CVarBase_index)();
-	static std::optional<fn_CVarBase_index> findCvarBaseIndex() {
-		auto mod = getReassemblyModule();
-		auto data = mod.getSegment(".data");
-		auto rdata = mod.getSegment(".rdata");
-		auto text = mod.getSegment(".text");
-
-		DPRINT_LOW("Searching for CVarBase::index offset...");
-
-		// Find offset of the CVarBase RTTI type descriptor.
-		auto rttiNameOffset = data.findOnlyString(".?AUCVarBase@@\0"s);
-		ANALYSIS_TRY(rttiNameOffset);
-		ANALYSIS_DBG("0x%p", *rttiNameOffset);
-		auto rttiTypeDescriptorOffset = *rttiNameOffset - offsetof(_TypeDescriptor, name);
-		ANALYSIS_DBG("0x%p", rttiTypeDescriptorOffset);
-		// Find offset of the CVarBase Complete Object Locator.
-		auto rttiColDescriptorOffsets = rdata.findOffset(rttiTypeDescriptorOffset);
-		ANALYSIS_DBG_LIST("0x%p", rttiColDescriptorOffsets);
-		Offset rttiColOffset = NULL;
-		for (auto potentialDescriptorOffset : rttiColDescriptorOffsets) {
-			auto potentialOffset = potentialDescriptorOffset  - offsetof(_s__RTTICompleteObjectLocator, pTypeDescriptor);
-			auto potentialRefs = rdata.findOffset(potentialOffset);
-			ANALYSIS_DBG_LIST("0x%p", potentialRefs);
-			if (potentialRefs.size() == 1) {
-				rttiColOffset = potentialOffset;
-				break;
-			}
-		}
-		if (!rttiColOffset) {
-			DPRINT_LOW("  Failed to find CVarBase _s__RTTICompleteObjectLocator.");
-			return std::nullopt;
-		}
-		// Find CVarBase vftable
-		auto vftableHeaderOffset = rdata.findOnlyOffset(rttiColOffset);
-		ANALYSIS_TRY(vftableHeaderOffset);
-		ANALYSIS_DBG("0x%p", *vftableHeaderOffset);
-		auto vftableOffset = *vftableHeaderOffset + 4;
-		ANALYSIS_DBG("0x%p", vftableOffset);
-		// Find potential entry points for the CVarBase constructor
-		auto cVarBasePotentialConstructors = text.findPotentialFunctionEntriesByOffset(vftableOffset, 0x200);
-		ANALYSIS_DBG_LIST("0x%p", cVarBasePotentialConstructors);
-
-		// Find offset of "kBlockOverlap" string
-		auto kBlockOverlapOffset = rdata.findOnlyString("kBlockOverlap\0"s);
-		ANALYSIS_TRY(kBlockOverlapOffset);
-		ANALYSIS_DBG("0x%p", *kBlockOverlapOffset);
-		// Find a function containing the offset of "kBlockOverlap"
-		auto kBlockOverlapSetup = text.findOnlyOffset(*kBlockOverlapOffset);
-		ANALYSIS_TRY(kBlockOverlapSetup);
-		ANALYSIS_DBG("0x%p", *kBlockOverlapSetup);
-		// Determine the actual entry point of CVarBase constructor
-		auto kBlockOverlapSetupFunc = mod.parseFunctionByOffset(*kBlockOverlapSetup + 4);
-		ANALYSIS_TRY(kBlockOverlapSetupFunc);
-		auto cvarBaseOffsets = kBlockOverlapSetupFunc->getCallOffsets(*kBlockOverlapSetup + 4);
-		ANALYSIS_DBG_LIST("0x%p", cvarBaseOffsets);
-		std::unordered_set<Offset> cvarBaseSet(cvarBaseOffsets.begin(), cvarBaseOffsets.end());
-		Offset cVarBaseConstructor = NULL;
-		for (auto potentialEntry : cVarBasePotentialConstructors) {
-			if (cvarBaseSet.find(potentialEntry) != cvarBaseSet.end()) {
-				cVarBaseConstructor = potentialEntry;
-				break;
-			}
-		}
-		if (!cVarBaseConstructor) {
-			DPRINT_LOW("  Failed to find CVarBase::CVarBase");
-			return std::nullopt;
-		}
-		ANALYSIS_DBG("0x%p", cVarBaseConstructor);
-
-		// Assume the second call in the CVarBase constructor is CVarBase::index
-		auto cVarBaseFunc = mod.parseFunctionByOffset(cVarBaseConstructor);
-		ANALYSIS_TRY(cVarBaseFunc);
-		auto constructorCallOffsets = cVarBaseFunc->getCallOffsets();
-		ANALYSIS_DBG_LIST("0x%p", constructorCallOffsets);
-		if (constructorCallOffsets.size() != 3) {
-			DPRINT_LOW("  Wrong number of calls in CVarBase::CvarBase constructor. (expected 3, found %d)", constructorCallOffsets.size());
-			return std::nullopt;
-		}
-		ANALYSIS_DBG("0x%p", constructorCallOffsets[1]);
-		return (fn_CVarBase_index) constructorCallOffsets[1];
+	static std::optional<fn_CVarBase_index> loadCvarBaseIndex() {
+		auto offset = resolveCached("CVarBase::index", CachedOffsetKind::Function, getSignatures().cvarBaseIndex);
+		ANALYSIS_TRY(offset);
+		return (fn_CVarBase_index) *offset;
 	}
-	static std::optional<fn_CVarBase_index> getCvarBaseIndex() {
-		static auto offset = findCvarBaseIndex();
+	static const std::optional<fn_CVarBase_index>& getCvarBaseIndex() {
+		static auto offset = loadCvarBaseIndex();
 		return offset;
 	}
 	bool cvarIndexLoaded() {
 		return getCvarBaseIndex().has_value();
 	}
-	std::map<lstring, CVarBase*>& CVarBase_index() {
-		auto func = getCvarBaseIndex();
+	static std::map<lstring, CVarBase*>& resolveCVarBase_index() {
+		auto& func = getCvarBaseIndex();
 		if (!func.has_value()) reportFatalError("Failed to find CVarBase::index offset.");
+		dispatchTable.CVarBase_index.store(*func, std::memory_order_relaxed);
 		return (*func)();
 	}
 #pragma endregion
+#pragma region Dispatch table
+	// Every slot is initialized with a function of its own type, without casts, so this is constant
+	// initialization. The stubs are in place before any static constructor calls through the table. Compilers
+	// with constinit check this.
+#ifdef __cpp_constinit
+	constinit
+#endif
+	DispatchTable dispatchTable = {
+		resolveNotifier_instance,
+		resolveNotifier_notify,
+		resolvePlayer_setMessage,
+		resolveCVarBase_index,
+	};
+
+	// Patches every slot whose function has been resolved, so even the first call skips the stub.
+	static void patchDispatchTable() {
+		auto& notifierOffsets = getNotifierOffsets();
+		if (notifierOffsets.has_value()) {
+			dispatchTable.Notifier_instance.store(notifierOffsets->Notifier_instance, std::memory_order_relaxed);
+			dispatchTable.Notifier_notify.store(notifierOffsets->Notifier_notify, std::memory_order_relaxed);
+		}
+		auto& setMessage = getPlayer_setMessage();
+		if (setMessage.has_value()) dispatchTable.Player_setMessage.store(*setMessage, std::memory_order_relaxed);
+		auto& cvarIndex = getCvarBaseIndex();
+		if (cvarIndex.has_value()) dispatchTable.CVarBase_index.store(*cvarIndex, std::memory_order_relaxed);
+	}
+#pragma endregion
+#pragma region Background analysis
+	static std::once_flag backgroundAnalysisStarted;
+	void startBackgroundAnalysis() {
+		std::call_once(backgroundAnalysisStarted, []() {
+			std::thread([]() {
+				// Globals are needed by the first DPRINT and the CVar index by the first DEFINE_CVAR, so those go first.
+				tryGetGlobals();
+				cvarIndexLoaded();
+				notifierOffsetsLoaded();
+				playerSetMessageLoaded();
+				patchDispatchTable();
+				getAnalysisCache().flush();
+				saveAnalysisStats();
+				DPRINT_LOW("Background analysis finished.");
+			}).detach();
+		});
+	}
+#pragma endregion
 }
\ No newline at end of file
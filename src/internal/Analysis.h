@@ -2,19 +2,61 @@
 
 #include <game/Save.h>
 
+#include <atomic>
+#include <map>
 #include <optional>
 
 namespace aiModInternal {
+	struct PEModule;
+
+	// The game functions called every frame. Each slot starts out pointing to a stub that resolves the
+	// function, patches the slot and forwards the call, so once a function is resolved a call through the
+	// table is a single indirect call with no checks. The table is aligned so it fills one cache line alone.
+	// A __thiscall function can't be declared outside a class, so member functions are held as __fastcall
+	// functions with an unused second argument, which take `this` in ECX and clean up the stack the same way.
+	// Each slot then has the exact type of its stub, and the table needs no casts to be constant initialized.
+	struct alignas(64) DispatchTable final {
+		std::atomic<Notifier& (*)()> Notifier_instance;
+		std::atomic<void (__fastcall *)(Notifier*, void*, const Notification&)> Notifier_notify;
+		std::atomic<void (__fastcall *)(Player*, void*, string)> Player_setMessage;
+		std::atomic<std::map<lstring, CVarBase*>& (*)()> CVarBase_index;
+	};
+	extern DispatchTable dispatchTable;
+
 	bool notifierOffsetsLoaded();
-	Notifier& Notifier_instance();
-    void Notifier_notify(Notifier*, const Notification&);
+	inline Notifier& Notifier_instance() {
+		return dispatchTable.Notifier_instance.load(std::memory_order_relaxed)();
+	}
+	inline void Notifier_notify(Notifier* notifier, const Notification& notification) {
+		dispatchTable.Notifier_notify.load(std::memory_order_relaxed)(notifier, NULL, notification);
+	}
 
 	std::optional<Globals*> tryGetGlobals();
 	Globals& getGlobals();
 
 	bool playerSetMessageLoaded();
-	void Player_setMessage(Player* player, string msg);
+	inline void Player_setMessage(Player* player, string msg) {
+		dispatchTable.Player_setMessage.load(std::memory_order_relaxed)(player, NULL, std::move(msg));
+	}
 
 	bool cvarIndexLoaded();
-	std::map<lstring, CVarBase*>& CVarBase_index();
+	inline std::map<lstring, CVarBase*>& CVarBase_index() {
+		return dispatchTable.CVarBase_index.load(std::memory_order_relaxed)();
+	}
+
+	// Starts resolving every offset above on a background thread, and returns without waiting for it. Each
+	// offset is resolved once, by whichever thread needs it first, so the accessors above only block on
+	// the offset they return and never on unrelated analysis.
+	void startBackgroundAnalysis();
+
+	struct ResolvedOffset final {
+		std::optional<uint32_t> rva;
+		uint64_t microseconds = 0;
+		int64_t memoryBytes = 0; // The change in process memory while resolving.
+	};
+	// Resolves every offset above against a module, without using the analysis cache. This works on images
+	// read from disk, and returns the RVA of each offset that was found. Offsets are resolved in order with
+	// one engine, so the time spent on indexes and shared signature steps is counted against the first
+	// offset that needs them.
+	std::map<string, ResolvedOffset> resolveAllOffsets(const PEModule& module);
 }
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "AnalysisCache.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <stdio.h>
+
+namespace aiModInternal {
+	static const uint32_t CACHE_MAGIC = 0x434D4941; // "AIMC"
+	static const uint32_t CACHE_VERSION = 3;
+
+	// Zeroes the words of a copy of a segment that the loader relocates, so the copy is the same wherever the
+	// image is loaded. Returns false if the relocation table isn't inside the image.
+	static bool undoRelocations(const PEModule& module, const Segment& segment, std::vector<uint8_t>& copy) {
+		auto directory = module.getDataDirectory(IMAGE_DIRECTORY_ENTRY_BASERELOC);
+		if (!directory.Size) return true;
+		auto start = module.fromRva(directory.VirtualAddress);
+		auto relocs = module.segmentForOffset(start);
+		if (!relocs.has_value() || directory.Size > (size_t) (relocs->base + relocs->length - start)) return false;
+
+		auto segmentRva = module.rva(segment.base);
+		for (auto block = start, end = start + directory.Size; block + sizeof(IMAGE_BASE_RELOCATION) <= end;) {
+			auto header = (const IMAGE_BASE_RELOCATION*) block;
+			if (header->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || header->SizeOfBlock > (size_t) (end - block))
+				return false;
+			auto entries = (const uint16_t*) (block + sizeof(IMAGE_BASE_RELOCATION));
+			auto count = (header->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(uint16_t);
+			for (size_t i = 0; i < count; i++) {
+				if (entries[i] >> 12 != IMAGE_REL_BASED_HIGHLOW) continue;
+				auto rva = header->VirtualAddress + (entries[i] & 0xFFF);
+				if (rva >= segmentRva && rva - segmentRva + 4 <= copy.size()) memset(&copy[rva - segmentRva], 0, 4);
+			}
+			block += header->SizeOfBlock;
+		}
+		return true;
+	}
+
+	// FNV-1a over .text, 8 bytes at a time, with relocations undone so the hash doesn't change when Windows
+	// loads the image at another base. This runs the first time an offset is resolved, which may be under the
+	// loader lock, so it only reads the loaded image and never the file on disk. Returns 0 on failure.
+	static uint64_t hashText(const PEModule& module) {
+		auto text = module.tryGetSegment(".text");
+		if (!text.has_value()) return 0;
+		std::vector<uint8_t> copy(text->base, text->base + text->length);
+		if (!undoRelocations(module, *text, copy)) return 0;
+
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		size_t i = 0;
+		for (; i + 8 <= copy.size(); i += 8) {
+			uint64_t word;
+			memcpy(&word, &copy[i], 8);
+			hash = (hash ^ word) * 0x100000001b3ULL;
+		}
+		for (; i < copy.size(); i++) hash = (hash ^ copy[i]) * 0x100000001b3ULL;
+		return hash;
+	}
+
+	bool AnalysisCache::Fingerprint::operator==(const Fingerprint& other) const {
+		return timeDateStamp == other.timeDateStamp && checksum == other.checksum &&
+		       imageSize == other.imageSize && textHash == other.textHash;
+	}
+
+	AnalysisCache::AnalysisCache(const PEModule& module, string path) : module(module), path(path) {
+		fingerprint.timeDateStamp = module.timeDateStamp;
+		fingerprint.checksum = module.checksum;
+		fingerprint.imageSize = module.imageSize;
+		fingerprint.textHash = hashText(module);
+		if (!fingerprint.textHash) {
+			DPRINT_LOW("Could not fingerprint %s. Not using the analysis cache.", module.name());
+			enabled = false;
+			return;
+		}
+		load();
+	}
+
+#pragma region Serialization
+	struct CacheReader {
+		const std::vector<uint8_t>& data;
+		size_t position = 0;
+		bool failed = false;
+
+		CacheReader(const std::vector<uint8_t>& data) : data(data) { }
+
+		template <typename T> T read() {
+			T t = T();
+			if (position + sizeof(T) > data.size()) failed = true;
+			else memcpy(&t, &data[position], sizeof(T));
+			position += sizeof(T);
+			return t;
+		}
+		string readString(size_t length) {
+			if (position + length > data.size()) {
+				failed = true;
+				return string();
+			}
+			auto str = string((const char*) &data[position], length);
+			position += length;
+			return str;
+		}
+	};
+	struct CacheWriter {
+		std::vector<uint8_t> data;
+
+		template <typename T> void write(T t) {
+			auto bytes = (const uint8_t*) &t;
+			data.insert(data.end(), bytes, bytes + sizeof(T));
+		}
+		void writeString(const string& str) {
+			data.insert(data.end(), str.begin(), str.end());
+		}
+	};
+
+	void AnalysisCache::load() {
+		auto file = fopen(path.c_str(), "rb");
+		if (!file) {
+			DPRINT_LOW("No analysis cache found at %s.", path.c_str());
+			return;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[4096];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + read);
+		fclose(file);
+
+		CacheReader reader(data);
+		if (reader.read<uint32_t>() != CACHE_MAGIC || reader.read<uint32_t>() != CACHE_VERSION) {
+			DPRINT_LOW("Analysis cache at %s has an unknown format. Ignoring.", path.c_str());
+			return;
+		}
+		Fingerprint cached;
+		cached.timeDateStamp = reader.read<uint32_t>();
+		cached.checksum = reader.read<uint32_t>();
+		cached.imageSize = reader.read<uint32_t>();
+		cached.textHash = reader.read<uint64_t>();
+		if (reader.failed || !(cached == fingerprint)) {
+			DPRINT_LOW("Analysis cache at %s was created for a different executable. Ignoring.", path.c_str());
+			return;
+		}
+
+		std::unordered_map<string, Entry> loaded;
+		auto count = reader.read<uint32_t>();
+		for (uint32_t i = 0; i < count && !reader.failed; i++) {
+			auto key = reader.readString(reader.read<uint16_t>());
+			Entry entry;
+			entry.kind = (CachedOffsetKind) reader.read<uint8_t>();
+			entry.rva = reader.read<uint32_t>();
+			entry.instructionRva = reader.read<uint32_t>();
+			entry.addressRva = reader.read<uint32_t>();
+			loaded[key] = entry;
+		}
+		if (reader.failed) {
+			DPRINT_LOW("Analysis cache at %s is truncated. Ignoring.", path.c_str());
+			return;
+		}
+
+		entries = std::move(loaded);
+		DPRINT_LOW("Loaded %d cached offsets from %s.", entries.size(), path.c_str());
+	}
+	void AnalysisCache::save() const {
+		CacheWriter writer;
+		writer.write(CACHE_MAGIC);
+		writer.write(CACHE_VERSION);
+		writer.write(fingerprint.timeDateStamp);
+		writer.write(fingerprint.checksum);
+		writer.write(fingerprint.imageSize);
+		writer.write(fingerprint.textHash);
+		writer.write((uint32_t) entries.size());
+		for (auto& pair : entries) {
+			writer.write((uint16_t) pair.first.size());
+			writer.writeString(pair.first);
+			writer.write((uint8_t) pair.second.kind);
+			writer.write(pair.second.rva);
+			writer.write(pair.second.instructionRva);
+			writer.write(pair.second.addressRva);
+		}
+
+		auto file = fopen(path.c_str(), "wb");
+		if (!file) {
+			DPRINT_LOW("Could not write analysis cache to %s.", path.c_str());
+			return;
+		}
+		fwrite(writer.data.data(), 1, writer.data.size(), file);
+		fclose(file);
+	}
+#pragma endregion
+
+	// Whether any operand of an instruction refers to an address directly, as an immediate or a memory operand
+	// without registers.
+	static bool usesAddress(const PEModule& module, const ZydisDecodedInstruction& instr, Offset address) {
+		for (size_t i = 0; i < instr.operandCount; i++) {
+			auto& operand = instr.operands[i];
+			if (operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE &&
+			    module.fromImageAddress((uint32_t) operand.imm.value.u) == address) return true;
+			if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY && operand.mem.base == ZYDIS_REGISTER_NONE &&
+			    operand.mem.index == ZYDIS_REGISTER_NONE && operand.mem.disp.hasDisplacement &&
+			    module.fromImageAddress((uint32_t) operand.mem.disp.value) == address) return true;
+		}
+		return false;
+	}
+
+	// Decodes the instruction an offset was found from again, and checks it still leads to the offset.
+	bool AnalysisCache::isValid(const Entry& entry) const {
+		auto offset = module.fromRva(entry.rva);
+		auto instructionOffset = module.fromRva(entry.instructionRva);
+		auto address = module.fromRva(entry.addressRva);
+		if (!module.containsOffset(offset) || !module.containsOffset(instructionOffset)) return false;
+		auto instr = module.decodeInstruction(instructionOffset);
+		if (!instr.has_value()) return false;
+
+		switch (entry.kind) {
+			case CachedOffsetKind::Function: {
+				if (instr->meta.category != ZYDIS_CATEGORY_CALL || address != offset) return false;
+				ZydisU64 target;
+				auto status = ZydisCalcAbsoluteAddress(&*instr, &instr->operands[0], &target);
+				return ZYDIS_SUCCESS(status) && (Offset) target == offset;
+			}
+			case CachedOffsetKind::Data:
+				return usesAddress(module, *instr, address);
+		}
+		return false;
+	}
+
+	std::optional<Offset> AnalysisCache::tryGet(const char* key) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!enabled) return std::nullopt;
+
+		auto find = entries.find(key);
+		if (find == entries.end()) return std::nullopt;
+		if (!isValid(find->second)) {
+			DPRINT_LOW("Cached offset for %s failed validation. Discarding.", key);
+			entries.erase(find);
+			return std::nullopt;
+		}
+		DPRINT_LOW("Using cached offset for %s.", key);
+		return module.fromRva(find->second.rva);
+	}
+	void AnalysisCache::put(const char* key, CachedOffsetKind kind, Offset offset, Offset instruction, Offset address) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!enabled) return;
+
+		module.boundsCheck(offset);
+		module.boundsCheck(instruction);
+		module.boundsCheck(address);
+		entries[key] = { kind, module.rva(offset), module.rva(instruction), module.rva(address) };
+		dirty = true;
+	}
+	void AnalysisCache::flush() {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!enabled || !dirty) return;
+		save();
+		dirty = false;
+	}
+}
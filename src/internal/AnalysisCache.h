@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace aiModInternal {
+	// How a cached offset was found, which decides how it's checked when it's loaded. Each offset is stored
+	// with the instruction it was found from and the address that instruction uses.
+	enum class CachedOffsetKind : uint8_t {
+		Function = 0, // The target of a call. The instruction must still be a direct call to the offset.
+		Data = 1, // An address used by an instruction, e.g. `cmp [globals.player], 0`. It must still use it.
+	};
+
+	// Stores offsets found by analysis between launches, so the full scan only needs to be run when the
+	// executable changes. The cache is keyed on the PE timestamp, checksum and image size of the module, and
+	// a hash of its .text segment. Offsets are stored as RVAs, and the instruction each was found from is
+	// decoded again when it is loaded. If the module can't be fingerprinted, the cache is not used.
+	struct AnalysisCache final {
+		// `path` is the cache file.
+		AnalysisCache(const PEModule& module, string path);
+		AnalysisCache(const AnalysisCache&) = delete;
+
+		std::optional<Offset> tryGet(const char* key);
+		// `instruction` is where the offset was found, and `address` the address it uses. See CachedOffsetKind.
+		// Entries are kept in memory until the next flush, so resolving several offsets writes the file once.
+		void put(const char* key, CachedOffsetKind kind, Offset offset, Offset instruction, Offset address);
+		void flush();
+
+	private:
+		struct Entry {
+			CachedOffsetKind kind;
+			uint32_t rva;
+			uint32_t instructionRva;
+			uint32_t addressRva;
+		};
+		struct Fingerprint {
+			uint32_t timeDateStamp;
+			uint32_t checksum;
+			uint32_t imageSize;
+			uint64_t textHash;
+
+			bool operator==(const Fingerprint& other) const;
+		};
+
+		const PEModule& module;
+		string path;
+		Fingerprint fingerprint;
+		std::unordered_map<string, Entry> entries;
+		std::mutex lock;
+		bool enabled = true;
+		bool dirty = false;
+
+		bool isValid(const Entry& entry) const;
+		void load();
+		void save() const;
+	};
+}
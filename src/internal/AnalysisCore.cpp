@@ -2,12 +2,24 @@
 #include <core/Str.h>
 
 #include "AnalysisCore.h"
+#include "Scanner.h"
+#include "ThreadPool.h"
+#include "XrefIndex.h"
+#include "ExportIndex.h"
+#include "FunctionMap.h"
+#include "RttiIndex.h"
+#include "FastDecoder.h"
 #include "Macros.h"
 #include "Utils.h"
 
 #include <algorithm>
 #include <map>
+#include <unordered_set>
+#ifdef _WIN32
 #include <psapi.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace aiModInternal {
 	static ZydisDecoder createDecoder() {
@@ -36,14 +48,16 @@ namespace aiModInternal {
 		}
 	}
 	std::string Segment::toString() const {
-		return str_format("%s (0x%p, 0x%x bytes)", name, base, length);
+		return str_format("%s (0x%p, 0x%x bytes)", name.c_str(), base, length);
 	}
 
+#ifdef _WIN32
 	static IMAGE_DOS_HEADER* getMzHeader(HMODULE mod) {
 		MODULEINFO moduleInfo;
 		GetModuleInformation(GetCurrentProcess(), mod, &moduleInfo, sizeof(MODULEINFO));
 		return (IMAGE_DOS_HEADER*) moduleInfo.lpBaseOfDll;
 	}
+#endif
 	static IMAGE_NT_HEADERS32* getPeHeader(IMAGE_DOS_HEADER* header) {
 		if (header->e_magic != IMAGE_DOS_SIGNATURE)
 			reportFatalError("Invalid MZ header.");
@@ -58,16 +72,104 @@ namespace aiModInternal {
 	static IMAGE_SECTION_HEADER* getSegmentTable(IMAGE_NT_HEADERS32* headers) {
 		return (IMAGE_SECTION_HEADER*)((char*)headers + 4 + sizeof(IMAGE_FILE_HEADER) + headers->FileHeader.SizeOfOptionalHeader);
 	}
-	PEModule::PEModule(HMODULE mod0) {
-		mod = mod0;
+
+	// Offsets are decoded as 32-bit addresses, so an image read from disk must be placed in the low 4 GB. Its
+	// preferred base is tried first, as no addresses need to be translated when the image ends up there.
+	static std::shared_ptr<uint8_t> allocateImage(size_t size, uint32_t preferredBase) {
+#ifdef _WIN32
+		auto image = (uint8_t*) VirtualAlloc((void*) (size_t) preferredBase, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!image) image = (uint8_t*) VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!image) reportFatalError("Could not allocate 0x%x bytes for module image.", size);
+		std::shared_ptr<uint8_t> ptr(image, [](uint8_t* image) { VirtualFree(image, 0, MEM_RELEASE); });
+#else
+		auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		auto image = mmap((void*) (size_t) preferredBase, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+#ifdef MAP_32BIT
+		if (image != MAP_FAILED && (size_t) image + size > 0xFFFFFFFF) {
+			munmap(image, size);
+			image = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_32BIT, -1, 0);
+		}
+#endif
+		if (image == MAP_FAILED) reportFatalError("Could not allocate 0x%x bytes for module image.", size);
+		std::shared_ptr<uint8_t> ptr((uint8_t*) image, [size](uint8_t* image) { munmap(image, size); });
+#endif
+		if ((size_t) ptr.get() + size > 0xFFFFFFFF)
+			reportFatalError("Could not allocate module image below 4 GB.");
+		return ptr;
+	}
+	static std::vector<uint8_t> readFile(const string& path) {
+		auto file = fopen(path.c_str(), "rb");
+		if (!file) reportFatalError("Could not open %s.", path.c_str());
+		std::vector<uint8_t> data;
+		uint8_t buffer[0x10000];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + read);
+		fclose(file);
+		return data;
+	}
+
+#ifdef _WIN32
+	PEModule::PEModule(HMODULE mod) {
 		modName = getModuleName(mod);
 
 		DPRINT_LOW("Parsing header for module %s...", modName);
 
-		auto mzHeader = getMzHeader(mod);
+		base = (Offset) getMzHeader(mod);
+		// Windows has already applied relocations, so the code refers to the address the module was loaded at.
+		preferredBase = (uint32_t) (size_t) base;
+		loadHeaders();
+	}
+#endif
+	PEModule::PEModule(const string& path) {
+		auto filename = path.find_last_of("/\\");
+		modName = filename == string::npos ? path : path.substr(filename + 1);
+
+		DPRINT_LOW("Reading module %s from disk...", path.c_str());
+
+		auto file = readFile(path);
+		if (file.size() < 1024 + sizeof(IMAGE_NT_HEADERS32))
+			reportFatalError("%s is too small to be a PE image.", path.c_str());
+		auto peHeader = getPeHeader((IMAGE_DOS_HEADER*) file.data());
+		if (peHeader->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+			reportFatalError("%s is not a PE32 image.", path.c_str());
+
+		// Lay out the headers and each section at their virtual addresses.
+		auto imageSize = peHeader->OptionalHeader.SizeOfImage;
+		imageData = allocateImage(imageSize, peHeader->OptionalHeader.ImageBase);
+		auto copyToImage = [&](uint32_t rva, uint32_t fileOffset, uint32_t size) {
+			if (fileOffset > file.size()) size = 0;
+			else size = std::min(size, (uint32_t) (file.size() - fileOffset));
+			if (rva > imageSize || size > imageSize - rva)
+				reportFatalError("Section at RVA 0x%x in %s is outside of the image.", rva, path.c_str());
+			memcpy(imageData.get() + rva, file.data() + fileOffset, size);
+		};
+		copyToImage(0, 0, peHeader->OptionalHeader.SizeOfHeaders);
+		auto segmentTable = getSegmentTable(peHeader);
+		if ((uint8_t*) (segmentTable + peHeader->FileHeader.NumberOfSections) > file.data() + file.size())
+			reportFatalError("Section table of %s is truncated.", path.c_str());
+		for (int i = 0; i < peHeader->FileHeader.NumberOfSections; i++) {
+			auto segmentInfo = &segmentTable[i];
+			auto rawSize = std::min(segmentInfo->SizeOfRawData, segmentInfo->Misc.VirtualSize);
+			copyToImage(segmentInfo->VirtualAddress, segmentInfo->PointerToRawData, rawSize);
+		}
+
+		base = imageData.get();
+		preferredBase = peHeader->OptionalHeader.ImageBase;
+		loadHeaders();
+	}
+	void PEModule::loadHeaders() {
+		auto mzHeader = (IMAGE_DOS_HEADER*) base;
 		auto peHeader = getPeHeader(mzHeader);
 		auto segmentTable = getSegmentTable(peHeader);
 
+		timeDateStamp = peHeader->FileHeader.TimeDateStamp;
+		checksum = peHeader->OptionalHeader.CheckSum;
+		imageSize = peHeader->OptionalHeader.SizeOfImage;
+		for (uint32_t i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; i++) {
+			if (i < peHeader->OptionalHeader.NumberOfRvaAndSizes) dataDirectories[i] = peHeader->OptionalHeader.DataDirectory[i];
+			else dataDirectories[i] = { 0, 0 };
+		}
+
 		for (int i = 0; i < peHeader->FileHeader.NumberOfSections; i++) {
 			auto segmentInfo = &segmentTable[i];
 
@@ -94,6 +196,11 @@ namespace aiModInternal {
 			if (lastEnd > next.base) 
 				reportFatalError("Segment %s overlaps segment %s in module %s.", last.name, next.name, modName.c_str());
 		}
+
+		xrefIndex = std::make_shared<XrefIndex>(*this);
+		exportIndex = std::make_shared<ExportIndex>(*this);
+		functionMap = std::make_shared<FunctionMap>(*this, xrefIndex);
+		rttiIndex = std::make_shared<RttiIndex>(*this, xrefIndex);
 	}
 
 	bool PEModule::hasSegment(const char* name) const {
@@ -117,11 +224,8 @@ namespace aiModInternal {
 			linearSegments.begin(), linearSegments.end(), offset,
 			[](const Segment& segment, const Offset& offset) { return segment.base < offset; }
 		);
-		if (bound != linearSegments.begin()) {
-			if (bound->containsOffset(offset)) return *bound;
-			bound--;
-			if (bound->containsOffset(offset)) return *bound;
-		}
+		if (bound != linearSegments.end() && bound->containsOffset(offset)) return *bound;
+		if (bound != linearSegments.begin() && (bound - 1)->containsOffset(offset)) return *(bound - 1);
 		return std::nullopt;
 	}
 
@@ -132,15 +236,7 @@ namespace aiModInternal {
 #pragma endregion
 
 #pragma region Function parsing related code
-	DecodedInstruction::DecodedInstruction(ZydisDecodedInstruction& instr) {
-		ASSERT_FATAL(instr.addressWidth == ZYDIS_ADDRESS_WIDTH_32);
-		ASSERT_FATAL(instr.instrAddress <= 0xFFFFFFFFL);
-		instrAddress = (Offset) instr.instrAddress;
-		length = instr.length;
-		opcode = instr.mnemonic;
-		category = instr.meta.category;
-	}
-	inline ZydisDecodedInstruction DecodedInstruction::decode() const {
+	ZydisDecodedInstruction DecodedInstruction::decode() const {
 		ZydisDecodedInstruction instr;
 		auto status = ZydisDecoderDecodeBuffer(&getDecoder(), (const void*) instrAddress, length, (ZydisU64) instrAddress, &instr);
 		ASSERT_FATAL(ZYDIS_SUCCESS(status));
@@ -154,217 +250,609 @@ namespace aiModInternal {
 		else return std::nullopt;
 	}
 
+	// An open addressing hash set of offsets, used to track which instructions have already been decoded.
+	struct OffsetSet final {
+		OffsetSet() : table(64, NULL) { }
+
+		bool contains(Offset offset) const {
+			for (auto i = hash(offset);; i = (i + 1) & (table.size() - 1)) {
+				if (table[i] == offset) return true;
+				if (table[i] == NULL) return false;
+			}
+		}
+		void insert(Offset offset) {
+			if ((count + 1) * 2 > table.size()) grow();
+			for (auto i = hash(offset);; i = (i + 1) & (table.size() - 1)) {
+				if (table[i] == offset) return;
+				if (table[i] == NULL) {
+					table[i] = offset;
+					count++;
+					return;
+				}
+			}
+		}
+
+	private:
+		std::vector<Offset> table;
+		size_t count = 0;
+
+		size_t hash(Offset offset) const {
+			return ((size_t) offset * 0x9E3779B1u) & (table.size() - 1);
+		}
+		void grow() {
+			auto old = std::move(table);
+			table.assign(old.size() * 2, NULL);
+			count = 0;
+			for (auto offset : old) if (offset) insert(offset);
+		}
+	};
+
+	static InstructionFlow flowForCategory(ZydisInstructionCategory category) {
+		switch (category) {
+			case ZYDIS_CATEGORY_CALL: return InstructionFlow::Call;
+			case ZYDIS_CATEGORY_COND_BR: return InstructionFlow::ConditionalBranch;
+			case ZYDIS_CATEGORY_UNCOND_BR: return InstructionFlow::UnconditionalBranch;
+			case ZYDIS_CATEGORY_RET: return InstructionFlow::Return;
+			case ZYDIS_CATEGORY_INTERRUPT: return InstructionFlow::Interrupt;
+			default: return InstructionFlow::None;
+		}
+	}
+	std::optional<InstructionBounds> decodeBoundsWithZydis(Offset offset, size_t remaining) {
+		ZydisDecodedInstruction instr;
+		auto status = ZydisDecoderDecodeBuffer(&getDecoder(), (const void*) offset, remaining, (ZydisU64) offset, &instr);
+		if (!ZYDIS_SUCCESS(status)) {
+			DPRINT_LOW("    Failed to parse instruction at offset 0x%p (status code: 0x%x)", offset, status);
+			return std::nullopt;
+		}
+		ASSERT_FATAL(instr.addressWidth == ZYDIS_ADDRESS_WIDTH_32);
+
+		InstructionBounds bounds = { instr.length, flowForCategory(instr.meta.category), NULL };
+		if (bounds.flow == InstructionFlow::Call || bounds.flow == InstructionFlow::ConditionalBranch ||
+		    bounds.flow == InstructionFlow::UnconditionalBranch) {
+			auto target = parseBranchTarget(instr);
+			if (target.has_value()) bounds.branchTarget = *target;
+		}
+		return bounds;
+	}
+
+	static void appendInstruction(ParsedFunction& function, Offset offset, const InstructionBounds& bounds) {
+		function.addresses.push_back(offset);
+		function.lengths.push_back(bounds.length);
+		function.flows.push_back(bounds.flow);
+		function.branchTargets.push_back(bounds.branchTarget);
+	}
+	static void copyInstruction(ParsedFunction& target, const ParsedFunction& source, size_t i) {
+		target.addresses.push_back(source.addresses[i]);
+		target.lengths.push_back(source.lengths[i]);
+		target.flows.push_back(source.flows[i]);
+		target.branchTargets.push_back(source.branchTargets[i]);
+	}
+
+	void ParsedFunction::decodeDetail(size_t i) const {
+		if (detailDecoded.empty()) {
+			detailDecoded.resize(size());
+			mnemonics.resize(size());
+			categories.resize(size());
+			operandCounts.resize(size());
+			operands.resize(size() * kMaxOperands);
+		}
+		if (detailDecoded[i]) return;
+
+		ZydisDecodedInstruction instr;
+		auto address = addresses[i];
+		auto status = ZydisDecoderDecodeBuffer(&getDecoder(), (const void*) address, lengths[i], (ZydisU64) address, &instr);
+		ASSERT_FATAL(ZYDIS_SUCCESS(status));
+		ASSERT_FATAL(instr.instrAddress <= 0xFFFFFFFFL);
+
+		auto operandCount = std::min((size_t) instr.operandCount, kMaxOperands);
+		for (size_t j = 0; j < operandCount; j++) {
+			auto& operand = instr.operands[j];
+			auto& compact = operands[i * kMaxOperands + j];
+			compact.type = operand.type;
+			compact.visibility = operand.visibility;
+			compact.action = operand.action;
+			compact.size = operand.size;
+			switch (operand.type) {
+				case ZYDIS_OPERAND_TYPE_REGISTER:
+					compact.reg = operand.reg.value;
+					break;
+				case ZYDIS_OPERAND_TYPE_MEMORY:
+					compact.reg = operand.mem.base;
+					compact.index = operand.mem.index;
+					compact.scale = operand.mem.scale;
+					compact.value = operand.mem.disp.hasDisplacement ? operand.mem.disp.value : 0;
+					break;
+				case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+					compact.value = operand.imm.value.s;
+					break;
+			}
+		}
+
+		mnemonics[i] = instr.mnemonic;
+		categories[i] = instr.meta.category;
+		operandCounts[i] = instr.operandCount;
+		detailDecoded[i] = true;
+	}
+
+	static std::optional<uint32_t> readImageValue(const PEModule& module, Offset offset) {
+		auto segment = module.segmentForOffset(offset);
+		if (!segment.has_value() || offset + 4 > segment->base + segment->length) return std::nullopt;
+		uint32_t value;
+		memcpy(&value, offset, 4);
+		return value;
+	}
+	static bool isImportAddress(const PEModule& module, Offset offset) {
+		auto directory = module.getDataDirectory(IMAGE_DIRECTORY_ENTRY_IAT);
+		auto start = module.fromRva(directory.VirtualAddress);
+		return directory.Size && offset >= start && offset < start + directory.Size;
+	}
+	// The pointer used by `call dword ptr [address]` or `jmp dword ptr [address]`.
+	static std::optional<Offset> absoluteIndirectPointer(const PEModule& module, Offset offset) {
+		if (offset[0] != 0xFF || (offset[1] != 0x15 && offset[1] != 0x25)) return std::nullopt;
+		auto address = readImageValue(module, offset + 2);
+		if (!address.has_value()) return std::nullopt;
+		return module.fromImageAddress(*address);
+	}
+
+	// Recovers the targets of a jump through a table from the bounds check MSVC emits before it, e.g.:
+	//
+	//     cmp eax, 12h
+	//     ja default
+	//     movzx eax, byte ptr [eax + indexTable] ; Only for sparse switches.
+	//     jmp dword ptr [eax*4 + table]
+	//
+	// run holds the instructions decoded in a straight line up to the jump.
+	static std::optional<IndirectBranch> recoverJumpTable(const PEModule& module, const Segment& seg,
+	                                                      const std::vector<Offset>& run) {
+		static const size_t kMaxLookBehind = 8, kMaxEntries = 0x1000;
+
+		auto jump = module.decodeInstruction(run.back());
+		if (!jump.has_value()) return std::nullopt;
+		auto& operand = jump->operands[0];
+		if (operand.type != ZYDIS_OPERAND_TYPE_MEMORY || operand.mem.base != ZYDIS_REGISTER_NONE ||
+		    operand.mem.index == ZYDIS_REGISTER_NONE || operand.mem.scale != 4) return std::nullopt;
+		auto indexRegister = operand.mem.index;
+		auto table = module.fromImageAddress((uint32_t) operand.mem.disp.value);
+
+		Offset byteTable = NULL;
+		size_t count = 0;
+		ZydisMnemonic boundsCheck = ZYDIS_MNEMONIC_INVALID;
+		for (size_t back = 1; back <= kMaxLookBehind && back < run.size() && !count; back++) {
+			auto instr = module.decodeInstruction(run[run.size() - 1 - back]);
+			if (!instr.has_value()) return std::nullopt;
+			if (instr->meta.category == ZYDIS_CATEGORY_COND_BR) {
+				boundsCheck = instr->mnemonic;
+				continue;
+			}
+			auto& dest = instr->operands[0];
+			auto& source = instr->operands[1];
+			if (dest.type != ZYDIS_OPERAND_TYPE_REGISTER || dest.reg.value != indexRegister) continue;
+			if (instr->mnemonic == ZYDIS_MNEMONIC_CMP && source.type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+				auto limit = (uint32_t) source.imm.value.u;
+				if (boundsCheck == ZYDIS_MNEMONIC_JNBE) count = (size_t) limit + 1;
+				else if (boundsCheck == ZYDIS_MNEMONIC_JNB) count = limit;
+				else return std::nullopt;
+				continue;
+			}
+			if (!isWriteAction(dest.action)) continue;
+
+			// The index is loaded from a table of bytes, indexed by the register that was bounds checked.
+			if (instr->mnemonic != ZYDIS_MNEMONIC_MOVZX || byteTable || source.type != ZYDIS_OPERAND_TYPE_MEMORY ||
+			    source.size != 8) return std::nullopt;
+			auto sourceRegister = source.mem.index != ZYDIS_REGISTER_NONE ? source.mem.index : source.mem.base;
+			if (source.mem.index != ZYDIS_REGISTER_NONE && (source.mem.base != ZYDIS_REGISTER_NONE || source.mem.scale != 1))
+				return std::nullopt;
+			byteTable = module.fromImageAddress((uint32_t) source.mem.disp.value);
+			indexRegister = sourceRegister;
+		}
+		if (!count || count > kMaxEntries) return std::nullopt;
+
+		if (byteTable) {
+			auto byteSegment = module.segmentForOffset(byteTable);
+			if (!byteSegment.has_value() || byteTable + count > byteSegment->base + byteSegment->length) return std::nullopt;
+			count = (size_t) *std::max_element(byteTable, byteTable + count) + 1;
+		}
+		IndirectBranch branch = { run.back(), IndirectBranchKind::JumpTable, table, 0, {} };
+		for (size_t i = 0; i < count; i++) {
+			auto value = readImageValue(module, table + 4 * i);
+			if (!value.has_value()) return std::nullopt;
+			auto target = module.fromImageAddress(*value);
+			if (!seg.containsOffset(target)) return std::nullopt;
+			if (std::find(branch.targets.begin(), branch.targets.end(), target) == branch.targets.end())
+				branch.targets.push_back(target);
+		}
+		return branch;
+	}
+
+	// Finds the instruction before i that last wrote a register, if it is a `mov reg, [base + disp]`, and moves i
+	// to it.
+	static std::optional<CompactOperand> findLoadBefore(const ParsedFunction& function, size_t& i, ZydisRegister reg) {
+		static const size_t kMaxLookBehind = 6;
+		for (size_t back = 1; back <= kMaxLookBehind && back <= i; back++) {
+			if (function.flows[i - back] != InstructionFlow::None) return std::nullopt;
+			auto instr = function.instruction(i - back);
+			if (!instr.operandCount) continue;
+			auto& dest = instr.operands[0];
+			if (dest.type != ZYDIS_OPERAND_TYPE_REGISTER || dest.reg != reg || !isWriteAction(dest.action)) continue;
+			auto& source = instr.operands[1];
+			if (instr.opcode != ZYDIS_MNEMONIC_MOV || source.type != ZYDIS_OPERAND_TYPE_MEMORY || source.size != 32 ||
+			    source.reg == ZYDIS_REGISTER_NONE || source.index != ZYDIS_REGISTER_NONE) return std::nullopt;
+			i -= back;
+			return source;
+		}
+		return std::nullopt;
+	}
+	// Classifies an indirect call or jump at instruction i that isn't a jump table.
+	static IndirectBranch classifyIndirectBranch(const PEModule& module, const ParsedFunction& function, size_t i) {
+		auto address = function.addresses[i];
+		IndirectBranch branch = { address, IndirectBranchKind::Unresolved, NULL, 0, {} };
+		auto pointer = absoluteIndirectPointer(module, address);
+		if (pointer.has_value()) {
+			branch.pointer = *pointer;
+			if (isImportAddress(module, *pointer)) branch.kind = IndirectBranchKind::Import;
+			return branch;
+		}
+
+		// A virtual call loads the vftable from the object, and calls through one of its slots, either directly
+		// or after loading the slot into a register.
+		auto instr = function.instruction(i);
+		if (!instr.operandCount) return branch;
+		auto slot = instr.operands[0];
+		if (slot.type == ZYDIS_OPERAND_TYPE_REGISTER) {
+			auto load = findLoadBefore(function, i, slot.reg);
+			if (!load.has_value()) return branch;
+			slot = *load;
+		} else if (slot.type != ZYDIS_OPERAND_TYPE_MEMORY || slot.reg == ZYDIS_REGISTER_NONE || slot.index != ZYDIS_REGISTER_NONE) {
+			return branch;
+		}
+		if (slot.value < 0 || slot.value % 4) return branch;
+		auto vftable = findLoadBefore(function, i, slot.reg);
+		if (!vftable.has_value() || vftable->value != 0) return branch;
+		branch.kind = IndirectBranchKind::VirtualCall;
+		branch.vftableSlot = (size_t) (slot.value / 4);
+		return branch;
+	}
+	static void classifyIndirectBranches(const PEModule& module, ParsedFunction& function,
+	                                     std::unordered_map<Offset, IndirectBranch>& jumpTables) {
+		for (size_t i = 0; i < function.size(); i++) {
+			auto flow = function.flows[i];
+			if (flow != InstructionFlow::Call && flow != InstructionFlow::UnconditionalBranch) continue;
+			auto address = function.addresses[i];
+			auto jumpTable = jumpTables.find(address);
+			if (jumpTable != jumpTables.end()) {
+				function.indirectBranches.push_back(std::move(jumpTable->second));
+				continue;
+			}
+			auto target = function.branchTargets[i];
+			if (!target || absoluteIndirectPointer(module, address).has_value()) {
+				function.indirectBranches.push_back(classifyIndirectBranch(module, function, i));
+				continue;
+			}
+			if (flow != InstructionFlow::Call || !module.segmentForOffset(target).has_value()) continue;
+			auto thunk = absoluteIndirectPointer(module, target);
+			if (thunk.has_value() && isImportAddress(module, *thunk))
+				function.indirectBranches.push_back({ address, IndirectBranchKind::ImportThunk, *thunk, 0, {} });
+		}
+	}
+
 	static std::optional<ParsedFunction> findInstructions(
-		Segment seg, Offset initialOffset, size_t maxInstructions
+		const PEModule& module, Segment seg, Offset initialOffset, size_t maxInstructions
 	) {
-		auto decoder = getDecoder();
-
-		std::map<Offset, DecodedInstruction> instructions;
+		// Instructions are stored in the order they are decoded, and sorted once the function is complete.
+		ParsedFunction unsorted(initialOffset);
+		OffsetSet visited;
 		std::vector<Offset> uncheckedOffsets;
 		uncheckedOffsets.push_back(initialOffset);
+		std::unordered_map<Offset, IndirectBranch> jumpTables;
+		std::vector<Offset> run; // The instructions decoded since the last branch target was taken.
 
 		// Iterate through every potential branch starting offset.
 		DPRINT_LOW("  Parsing function at 0x%p...", initialOffset);
-		ZydisDecodedInstruction instr;
 		while (uncheckedOffsets.size() > 0) {
 			auto offset = uncheckedOffsets.back();
 			uncheckedOffsets.pop_back();
 
-			if (instructions.find(offset) != instructions.end()) continue;
+			if (visited.contains(offset)) continue;
 			if (!seg.containsOffset(offset)) {
 				DPRINT_LOW("    Function jumps to offset 0x%p outside of segment %s!", offset, seg.name);
 				return std::nullopt;
 			}
 			auto remaining = seg.length - (offset - seg.base);
+			run.clear();
 
 			// Decode instructions until we hit an unconditional branch or return.
 			for (;;) {
-				if (instructions.find(offset) != instructions.end()) break;
+				if (visited.contains(offset)) break;
 
-				auto status = ZydisDecoderDecodeBuffer(&decoder, (const void*) offset, remaining, (ZydisU64) offset, &instr);
-				if (!ZYDIS_SUCCESS(status)) {
-					DPRINT_LOW("    Failed to parse instruction at offset 0x%p (status code: 0x%x)", offset, status);
-					return std::nullopt;
-				}
-				if (instructions.size() > maxInstructions) {
+				// Most instructions only need the lookup tables. The rest are decoded by Zydis.
+				auto bounds = decodeBounds(offset, remaining);
+				if (!bounds.has_value()) bounds = decodeBoundsWithZydis(offset, remaining);
+				if (!bounds.has_value()) return std::nullopt;
+				if (unsorted.size() > maxInstructions) {
 					DPRINT_LOW("    Found more than %d instructions, assuming analysis failed somewhere.", maxInstructions);
 					return std::nullopt;
 				}
+				visited.insert(offset);
+				appendInstruction(unsorted, offset, *bounds);
+				run.push_back(offset);
 
 				auto continuesToNext = true;
-				switch (instr.meta.category) {
-					case ZYDIS_CATEGORY_UNCOND_BR:
+				switch (bounds->flow) {
+					case InstructionFlow::UnconditionalBranch:
 						continuesToNext = false;
+						// `jmp dword ptr [address]` leaves the function, usually for an import.
+						if (absoluteIndirectPointer(module, offset).has_value()) break;
+						if (!bounds->branchTarget) {
+							auto jumpTable = recoverJumpTable(module, seg, run);
+							if (jumpTable.has_value()) {
+								DPRINT_LOW("    Found jump table at 0x%p with %d targets.", offset, jumpTable->targets.size());
+								uncheckedOffsets.insert(uncheckedOffsets.end(), jumpTable->targets.begin(), jumpTable->targets.end());
+								jumpTables[offset] = std::move(*jumpTable);
+								break;
+							}
+						}
 						// intentionally falls through
-					case ZYDIS_CATEGORY_COND_BR: {
-						auto branchTarget = parseBranchTarget(instr);
-						if (branchTarget.has_value()) uncheckedOffsets.push_back(*branchTarget);
+					case InstructionFlow::ConditionalBranch:
+						if (bounds->branchTarget) uncheckedOffsets.push_back(bounds->branchTarget);
 						else DPRINT_LOW("    Found unparsable branch at 0x%p. Ignoring.", offset);
 						break;
-					}
-					case ZYDIS_CATEGORY_INTERRUPT:
+					case InstructionFlow::Interrupt:
 						DPRINT_LOW("    Found interrupt instruction at 0x%p, assuming analysis left the function.", offset);
 						// intentionally falls through
-					case ZYDIS_CATEGORY_RET:
+					case InstructionFlow::Return:
 						continuesToNext = false;
 						break;
 				}
-				instructions[offset] = DecodedInstruction(instr);
 				if (!continuesToNext) break;
 
-				remaining -= instr.length;
-				offset += instr.length;
+				remaining -= bounds->length;
+				offset += bounds->length;
 			}
 		}
 
+		// Sort the instructions by address.
+		ASSERT_FATAL(unsorted.size());
+		std::vector<uint32_t> order(unsorted.size());
+		for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return unsorted.addresses[a] < unsorted.addresses[b];
+		});
+
 		// Check for overlapping instructions, and count some instructions in the meantime.
 		ptrdiff_t maxGap = 0;
 		size_t gapCount = 0;
-		ASSERT_FATAL(instructions.size());
-		if (instructions.size() > 1) 
-			for (auto last = instructions.begin(), curr = ++instructions.begin(); curr != instructions.end(); last++, curr++) {
-				auto lastAddr = last->second.instrAddress + last->second.length;
-				auto currAddr = curr->second.instrAddress;
-				if (currAddr < lastAddr) {
-					DPRINT_LOW("    Instruction at 0x%p overlaps instruction at 0x%p.", last->first, curr->first);
-					return std::nullopt;
-				}
-				if (currAddr != lastAddr) {
-					maxGap = max(maxGap, currAddr - lastAddr);
-					gapCount++;
-				}
+		for (size_t i = 1; i < order.size(); i++) {
+			auto lastAddr = unsorted.addresses[order[i - 1]] + unsorted.lengths[order[i - 1]];
+			auto currAddr = unsorted.addresses[order[i]];
+			if (currAddr < lastAddr) {
+				DPRINT_LOW("    Instruction at 0x%p overlaps instruction at 0x%p.", 
+				           unsorted.addresses[order[i - 1]], currAddr);
+				return std::nullopt;
+			}
+			if (currAddr != lastAddr) {
+				maxGap = max(maxGap, currAddr - lastAddr);
+				gapCount++;
 			}
+		}
 
 		// Create ParsedFunction.
-		std::vector<DecodedInstruction> linearInstructions;
-		for (auto pair : instructions) linearInstructions.push_back(pair.second);
-		auto parsed = ParsedFunction(initialOffset, linearInstructions);
+		ParsedFunction parsed(initialOffset);
+		for (auto i : order) copyInstruction(parsed, unsorted, i);
+		classifyIndirectBranches(module, parsed, jumpTables);
 		DPRINT_LOW("    Found %d instructions. (range = [0x%p, 0x%p], gaps = %d, max gap = %d)", 
-		           linearInstructions.size(),
-		           (Offset) linearInstructions[0].instrAddress, (Offset) linearInstructions.back().instrAddress,
-		           gapCount, maxGap);
+		           parsed.size(), parsed.addresses[0], parsed.addresses.back(), gapCount, maxGap);
 		return parsed;
 	}
 
 	std::optional<Offset> PEModule::getFunctionByName(const char* name) const {
-		auto proc = (Offset) GetProcAddress(mod, name);
-		boundsCheck(proc);
-		return proc;
+		auto symbol = exports().findByName(name);
+		if (!symbol.has_value()) {
+			DPRINT_LOW("  Could not find export %s in module %s.", name, modName.c_str());
+			return std::nullopt;
+		}
+		return symbol->offset;
+	}
+	string PEModule::describeOffset(Offset offset) const {
+		auto symbol = exports().findNearest(offset);
+		if (!symbol.has_value() || !segmentForOffset(offset).has_value()) return str_format("0x%p", offset);
+		if (symbol->offset == offset) return symbol->name;
+		return str_format("%s+0x%x", symbol->name, (uint32_t) (offset - symbol->offset));
 	}
 	std::optional<ParsedFunction> PEModule::parseFunctionByName(const char* name, size_t maxInstructions) const {
-		return parseFunctionByOffset((Offset) GetProcAddress(mod, name), maxInstructions);
+		auto proc = getFunctionByName(name);
+		if (!proc.has_value()) return std::nullopt;
+		return parseFunctionByOffset(*proc, maxInstructions);
 	}
 	std::optional<ParsedFunction> PEModule::parseFunctionByOffset(Offset offset, size_t maxInstructions) const {
 		boundsCheck(offset);
 		auto segment = *segmentForOffset(offset);
-		return findInstructions(segment, offset, maxInstructions);
+		return findInstructions(*this, segment, offset, maxInstructions);
+	}
+	std::vector<std::optional<ParsedFunction>> PEModule::parseFunctionsByOffset(
+		const std::vector<Offset>& offsets, size_t maxInstructions, bool deduplicate
+	) const {
+		DPRINT_LOW("  Parsing %d potential functions...", offsets.size());
+		std::vector<std::optional<ParsedFunction>> functions(offsets.size());
+		ThreadPool::instance().parallelFor(offsets.size(), [&](size_t i) {
+			functions[i] = parseFunctionByOffset(offsets[i], maxInstructions);
+		});
+
+		if (deduplicate) {
+			std::unordered_set<Offset> seen;
+			for (auto& function : functions) {
+				if (!function.has_value()) continue;
+				auto overlaps = std::any_of(
+					function->addresses.begin(), function->addresses.end(),
+					[&](Offset address) { return seen.find(address) != seen.end(); }
+				);
+				if (overlaps) {
+					DPRINT_LOW("    Function at 0x%p overlaps an earlier function. Skipping.", function->functionStart);
+					function = std::nullopt;
+					continue;
+				}
+				seen.insert(function->addresses.begin(), function->addresses.end());
+			}
+		}
+		return functions;
+	}
+	std::optional<ZydisDecodedInstruction> PEModule::decodeInstruction(Offset offset) const {
+		auto segment = segmentForOffset(offset);
+		if (!segment.has_value()) return std::nullopt;
+
+		ZydisDecodedInstruction instr;
+		auto remaining = segment->length - (offset - segment->base);
+		auto status = ZydisDecoderDecodeBuffer(&getDecoder(), (const void*) offset, remaining, (ZydisU64) offset, &instr);
+		if (!ZYDIS_SUCCESS(status)) return std::nullopt;
+		return instr;
 	}
 #pragma endregion
 
 #pragma region Data analysis
-	static std::optional<Offset> ifOnly(std::vector<Offset> vec) {
+	std::optional<Offset> ifOnly(std::vector<Offset> vec) {
 		if (vec.size() == 0) return std::nullopt;
 		if (vec.size() > 1) {
-			DPRINT_LOW("    Found %d instances of string!", vec.size());
+			DPRINT_LOW("    Expected one instance, found at least %d.", vec.size());
 			return std::nullopt;
 		}
 		return vec[0];
 	}
 
-	std::vector<Offset> Segment::findString(string str) const {
-		std::vector<Offset> foundList;
-		auto seg_begin = (const char*) base;
-		auto seg_end = (const char*) (base + length);
+	// Collects at most limit offsets from a visit function.
+	template <typename Visit> static std::vector<Offset> collectOffsets(size_t limit, Visit visit) {
+		std::vector<Offset> results;
+		if (limit == 0) return results;
+		visit([&](Offset offset) {
+			results.push_back(offset);
+			return results.size() < limit;
+		});
+		return results;
+	}
 
-		while (true) {
-			auto found = std::search(seg_begin, seg_end, str.begin(), str.end());
-			if (found == seg_end) return foundList;
-			foundList.push_back((Offset) found);
-			seg_begin = found + 1;
-		}
+	void Segment::visitString(const string& str, const std::function<bool(Offset)>& visit) const {
+		MultiPatternScanner scanner;
+		scanner.addString(str);
+		scanner.scanWith(*this, [&](size_t, Offset offset) { return visit(offset); });
+	}
+	std::vector<Offset> Segment::findString(string str, size_t limit) const {
+		return collectOffsets(limit, [&](const std::function<bool(Offset)>& visit) { visitString(str, visit); });
+	}
+	std::vector<std::vector<Offset>> Segment::findStrings(const std::vector<string>& strs) const {
+		MultiPatternScanner scanner;
+		for (auto& str : strs) scanner.addString(str);
+		return scanner.scan(*this);
 	}
 	std::optional<Offset> Segment::findOnlyString(string str) const {
-		return ifOnly(findString(str));
+		return ifOnly(findString(str, 2));
 	}
 
-	std::vector<Offset> Segment::findOffset(Offset offset) const {
-		return findString(string((const char*) &offset, 4));
+	void Segment::visitOffset(Offset offset, const std::function<bool(Offset)>& visit) const {
+		MultiPatternScanner scanner;
+		scanner.addOffset(offset);
+		scanner.scanWith(*this, [&](size_t, Offset found) { return visit(found); });
+	}
+	std::vector<Offset> Segment::findOffset(Offset offset, size_t limit) const {
+		return collectOffsets(limit, [&](const std::function<bool(Offset)>& visit) { visitOffset(offset, visit); });
+	}
+	std::vector<std::vector<Offset>> Segment::findOffsets(const std::vector<Offset>& offsets) const {
+		MultiPatternScanner scanner;
+		for (auto offset : offsets) scanner.addOffset(offset);
+		return scanner.scan(*this);
 	}
 	std::optional<Offset> Segment::findOnlyOffset(Offset offset) const {
-		return ifOnly(findOffset(offset));
+		return ifOnly(findOffset(offset, 2));
+	}
+
+	static int parseHexDigit(char ch) {
+		if (ch >= '0' && ch <= '9') return ch - '0';
+		if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+		if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+		return -1;
+	}
+	BytePattern BytePattern::parse(const char* pattern) {
+		BytePattern parsed;
+		auto hasFixedByte = false;
+		for (auto ch = pattern; *ch;) {
+			if (*ch == ' ') {
+				ch++;
+			} else if (*ch == '?') {
+				ch += ch[1] == '?' ? 2 : 1;
+				parsed.bytes.push_back(0);
+				parsed.mask.push_back(0);
+			} else {
+				auto high = parseHexDigit(ch[0]), low = high < 0 ? -1 : parseHexDigit(ch[1]);
+				if (low < 0) reportFatalError("Invalid byte in pattern \"%s\".", pattern);
+				ch += 2;
+				parsed.bytes.push_back((uint8_t) (high * 16 + low));
+				parsed.mask.push_back(0xFF);
+				hasFixedByte = true;
+			}
+		}
+		if (!hasFixedByte) reportFatalError("Pattern \"%s\" has no bytes to match.", pattern);
+		return parsed;
 	}
 
-	// Assumes there is padding between all factions (0xCC) and that functions are aligned by 0x10 bytes.
-	static void findFunctionEntries(Segment seg, std::vector<Offset>& offsets, Offset offset, size_t maxInstructions) {
-		seg.boundsCheck(offset);
-		ASSERT_FATAL((maxInstructions & 0xF) == 0);
-
-		offset = (Offset) ((size_t) offset & ~0xF);
-		auto min = offset - maxInstructions;
-		if (min < seg.base) min = seg.base;
-		for (; offset >= min; offset -= 0x10) {
-			if (offset != seg.base && *(offset - 1) != 0xCC) continue;
-			offsets.push_back(offset);
-		}
+	void Segment::visitPattern(const BytePattern& pattern, const std::function<bool(Offset)>& visit) const {
+		MaskedPatternScanner scanner;
+		scanner.addPattern(pattern);
+		scanner.scanWith(*this, [&](size_t, Offset offset) { return visit(offset); });
+	}
+	std::vector<Offset> Segment::findPattern(const BytePattern& pattern, size_t limit) const {
+		return collectOffsets(limit, [&](const std::function<bool(Offset)>& visit) { visitPattern(pattern, visit); });
 	}
-	std::vector<Offset> Segment::findPotentialFunctionEntries(Offset offset, size_t maxInstructions) const {
-		std::vector<Offset> offsets;
-		findFunctionEntries(*this, offsets, offset, maxInstructions);
-		DPRINT_LOW("  Found %d potential function entry points.", offsets.size());
-		return offsets;
-	}
-	std::vector<Offset> Segment::findPotentialFunctionEntriesByOffset(Offset offset, size_t maxInstructions) const {
-		std::vector<Offset> offsets;
-		DPRINT_LOW("  Searching segment %s for function entry points containing offset 0x%p.", name.c_str(), offset);
-		for (auto occurance : findOffset(offset)) 
-			findFunctionEntries(*this, offsets, occurance, maxInstructions);
-		DPRINT_LOW("    Found %d potential function entry points.", offsets.size());
-		return offsets;
-	}
-	std::vector<Offset> Segment::findPotentialFunctionEntriesByString(string str, size_t maxInstructions) const {
-		std::vector<Offset> offsets;
-		DPRINT_LOW("  Searching segment %s for function entry points containing string with length %d.", name.c_str(), str.size());
-		for (auto occurance : findString(str))
-			findFunctionEntries(*this, offsets, occurance, maxInstructions);
-		DPRINT_LOW("    Found %d potential function entry points.", offsets.size());
-		return offsets;
+	std::vector<std::vector<Offset>> Segment::findPatterns(const std::vector<BytePattern>& patterns) const {
+		MaskedPatternScanner scanner;
+		for (auto& pattern : patterns) scanner.addPattern(pattern);
+		return scanner.scan(*this);
+	}
+	std::optional<Offset> Segment::findOnlyPattern(const BytePattern& pattern) const {
+		return ifOnly(findPattern(pattern, 2));
 	}
 #pragma endregion
 
 #pragma region Function analysis
-	static bool isInInstruction(const DecodedInstruction& instr, Offset offset) {
-		return instr.instrAddress >= offset && offset < (instr.instrAddress + instr.length);
+	static bool isInInstruction(const ParsedFunction& function, size_t i, Offset offset) {
+		return offset >= function.addresses[i] && offset < (function.addresses[i] + function.lengths[i]);
 	}
 	bool ParsedFunction::isOffsetInFunction(Offset offset) const {
-		auto bound = findInstructionsAfter(offset);
-		if (bound == instructions.size()) return false;
-		if (bound != 0 && isInInstruction(instructions[bound - 1], offset)) return true;
-		return isInInstruction(instructions[bound], offset);
+		auto bound = std::lower_bound(addresses.begin(), addresses.end(), offset) - addresses.begin();
+		if (bound != size() && isInInstruction(*this, bound, offset)) return true;
+		return bound != 0 && isInInstruction(*this, bound - 1, offset);
 	}
 	size_t ParsedFunction::findInstructionsAfter(Offset offset) const {
-		auto bound = std::lower_bound(
-			instructions.begin(), instructions.end(), offset,
-			[](DecodedInstruction instr, Offset off) { return instr.instrAddress < off; }
-		);
-		if (bound == instructions.end()) return instructions.size();
-		if (isInInstruction(*bound, offset)) bound++;
-		return bound - instructions.begin();
+		return std::upper_bound(addresses.begin(), addresses.end(), offset) - addresses.begin();
+	}
+	const IndirectBranch* ParsedFunction::findIndirectBranch(Offset address) const {
+		auto find = std::lower_bound(indirectBranches.begin(), indirectBranches.end(), address,
+		                             [](const IndirectBranch& branch, Offset address) { return branch.address < address; });
+		if (find == indirectBranches.end() || find->address != address) return NULL;
+		return &*find;
 	}
 
 	std::vector<Offset> ParsedFunction::getCallOffsets(Offset after) const {
 		DPRINT_LOW("  Finding call offsets starting at 0x%p.", after ? after : functionStart);
 		std::vector<Offset> calls;
 		auto idx = after ? findInstructionsAfter(after) : 0;
-		for (auto it = instructions.begin() + idx; it != instructions.end(); it++) {
-			if (it->category == ZYDIS_CATEGORY_CALL) {
-				auto decoded = it->decode();
-				auto target = parseBranchTarget(decoded);
-				if (!target.has_value())
-					DPRINT_LOW("    Could not parse call at 0x%p. Skipping.", (Offset) it->instrAddress);
-				else calls.push_back(*target);
+		for (auto i = idx; i < size(); i++) {
+			if (flows[i] == InstructionFlow::Call) {
+				if (!branchTargets[i])
+					DPRINT_LOW("    Could not parse call at 0x%p. Skipping.", addresses[i]);
+				else calls.push_back(branchTargets[i]);
 			}
 		}
 		return calls;
 	}
+	std::vector<Offset> ParsedFunction::getCallSites(Offset after) const {
+		std::vector<Offset> sites;
+		auto idx = after ? findInstructionsAfter(after) : 0;
+		for (auto i = idx; i < size(); i++)
+			if (flows[i] == InstructionFlow::Call && branchTargets[i]) sites.push_back(addresses[i]);
+		return sites;
+	}
+	bool ParsedFunction::isCallTo(Offset site, Offset target) const {
+		auto find = std::lower_bound(addresses.begin(), addresses.end(), site);
+		if (find == addresses.end() || *find != site) return false;
+		auto i = find - addresses.begin();
+		return flows[i] == InstructionFlow::Call && branchTargets[i] == target;
+	}
 #pragma endregion
 }
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
 #include "Macros.h"
+#include "PEFormat.h"
 #include "Utils.h"
 
-#include <Windows.h>
-#include <zydis/Zydis.h>
+#include <Zydis/Zydis.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <optional>
@@ -12,6 +15,31 @@
 namespace aiModInternal {
 	typedef uint8_t* Offset;
 	struct ParsedFunction;
+	struct XrefIndex;
+	struct ExportIndex;
+	struct FunctionMap;
+	struct RttiIndex;
+
+	std::optional<Offset> ifOnly(std::vector<Offset> vec);
+
+	// A sequence of bytes where some bytes can be anything, e.g. `E8 ?? ?? ?? ?? 8B 0D ?? ?? ?? ??`.
+	struct BytePattern final {
+		std::vector<uint8_t> bytes;
+		std::vector<uint8_t> mask; // 0xFF for bytes that have to match, and 0 for wildcards.
+
+		// Parses hex bytes separated by spaces, with `?` or `??` for a wildcard. At least one byte has to match.
+		static BytePattern parse(const char* pattern);
+
+		inline size_t size() const {
+			return bytes.size();
+		}
+		inline bool matches(const uint8_t* data) const {
+			for (size_t i = 0; i < bytes.size(); i++) {
+				if ((data[i] & mask[i]) != bytes[i]) return false;
+			}
+			return true;
+		}
+	};
 
 	struct Segment final {
 		std::string name;
@@ -20,67 +48,231 @@ namespace aiModInternal {
 		size_t length;
 
 		inline bool containsOffset(Offset offset) const {
-			return base < offset && offset < (base + length);
+			return base <= offset && offset < (base + length);
 		}
 		void boundsCheck(Offset offset) const;
 		std::string toString() const;
 
-		std::vector<Offset> findString(string str) const;
+		// The visit functions call visit with each occurrence of a needle in order, and stop scanning as soon
+		// as it returns false. The find functions stop once limit occurrences have been found, so only the
+		// first occurrences of a common needle are collected, and findOnly stops at the second occurrence.
+		void visitString(const string& str, const std::function<bool(Offset)>& visit) const;
+		std::vector<Offset> findString(string str, size_t limit = SIZE_MAX) const;
+		std::vector<std::vector<Offset>> findStrings(const std::vector<string>& strs) const;
 		std::optional<Offset> findOnlyString(string str) const;
-		
-		std::vector<Offset> findOffset(Offset offset) const;
+
+		void visitOffset(Offset offset, const std::function<bool(Offset)>& visit) const;
+		std::vector<Offset> findOffset(Offset offset, size_t limit = SIZE_MAX) const;
+		std::vector<std::vector<Offset>> findOffsets(const std::vector<Offset>& offsets) const;
 		std::optional<Offset> findOnlyOffset(Offset offset) const;
 
-		std::vector<Offset> findPotentialFunctionEntries(Offset offset, size_t maxInstructions) const;
-		std::vector<Offset> findPotentialFunctionEntriesByOffset(Offset offset, size_t maxInstructions) const;
-		std::vector<Offset> findPotentialFunctionEntriesByString(string str, size_t maxInstructions) const;
+		void visitPattern(const BytePattern& pattern, const std::function<bool(Offset)>& visit) const;
+		std::vector<Offset> findPattern(const BytePattern& pattern, size_t limit = SIZE_MAX) const;
+		std::vector<std::vector<Offset>> findPatterns(const std::vector<BytePattern>& patterns) const;
+		std::optional<Offset> findOnlyPattern(const BytePattern& pattern) const;
 	};
 	struct PEModule final {
+#ifdef _WIN32
+		// A module loaded into the current process.
 		PEModule(HMODULE mod);
+#endif
+		// A PE32 image read from disk and laid out as the loader would, without applying relocations.
+		explicit PEModule(const string& path);
 
 		inline const char* name() const {
 			return modName.c_str(); 
 		}
+		inline Offset imageBase() const {
+			return base;
+		}
+		inline uint32_t rva(Offset offset) const {
+			return (uint32_t) (offset - base);
+		}
+		inline Offset fromRva(uint32_t rva) const {
+			return base + rva;
+		}
+		// Converts between offsets and the addresses used by the code in the image. These are the same for a
+		// module loaded by Windows, but differ for an image read from disk, which is not relocated.
+		inline Offset fromImageAddress(uint32_t address) const {
+			return base + (address - preferredBase);
+		}
+		inline uint32_t toImageAddress(Offset offset) const {
+			return rva(offset) + preferredBase;
+		}
 
 		bool hasSegment(const char* name) const;
 		bool containsOffset(Offset offset) const;
 		std::optional<Segment> tryGetSegment(const char* name) const;
 		Segment getSegment(const char* name) const;
 		std::optional<Segment> segmentForOffset(Offset offset) const;
+		inline const vector<Segment>& getSegments() const {
+			return linearSegments;
+		}
+
+		inline IMAGE_DATA_DIRECTORY getDataDirectory(size_t index) const {
+			return dataDirectories[index];
+		}
 
 		std::optional<Offset> getFunctionByName(const char* name) const;
+		// Names an offset after the closest export at or before it, e.g. `?update@AI@@QAEXXZ+0x1c`.
+		string describeOffset(Offset offset) const;
 		std::optional<ParsedFunction> parseFunctionByName(const char* name, size_t maxInstructions = 10000) const;
 		std::optional<ParsedFunction> parseFunctionByOffset(Offset offset, size_t maxInstructions = 10000) const;
+		// Parses a batch of potential function entries in parallel. Results are returned in the same order as
+		// the entries, with an empty slot for each entry that doesn't parse. When deduplicating, a function that
+		// shares an instruction with a function earlier in the list is dropped and its slot left empty too, so
+		// the order of the entries decides which of two overlapping functions is kept.
+		std::vector<std::optional<ParsedFunction>> parseFunctionsByOffset(
+			const std::vector<Offset>& offsets, size_t maxInstructions = 10000, bool deduplicate = false
+		) const;
+		std::optional<ZydisDecodedInstruction> decodeInstruction(Offset offset) const;
 
 		void boundsCheck(Offset offset) const;
 
+		// The cross reference, export, function and RTTI indexes for this module, shared by every copy of it.
+		inline XrefIndex& xrefs() const {
+			return *xrefIndex;
+		}
+		inline ExportIndex& exports() const {
+			return *exportIndex;
+		}
+		inline FunctionMap& functions() const {
+			return *functionMap;
+		}
+		inline RttiIndex& rtti() const {
+			return *rttiIndex;
+		}
+
+		// Values copied from the PE header, used to identify a particular build of the module.
+		uint32_t timeDateStamp;
+		uint32_t checksum;
+		uint32_t imageSize;
+
 	private:
-		HMODULE mod;
 		string modName;
+		Offset base;
+		uint32_t preferredBase;
+		IMAGE_DATA_DIRECTORY dataDirectories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+		std::shared_ptr<uint8_t> imageData; // Owns the image when it was read from disk.
 		std::unordered_map<string, Segment> segments;
 		vector<Segment> linearSegments;
+		std::shared_ptr<XrefIndex> xrefIndex;
+		std::shared_ptr<ExportIndex> exportIndex;
+		std::shared_ptr<FunctionMap> functionMap;
+		std::shared_ptr<RttiIndex> rttiIndex;
+
+		void loadHeaders();
+	};
+
+	inline bool isWriteAction(ZydisOperandAction action) {
+		switch (action) {
+			case ZYDIS_OPERAND_ACTION_WRITE:
+			case ZYDIS_OPERAND_ACTION_READWRITE:
+			case ZYDIS_OPERAND_ACTION_CONDWRITE:
+			case ZYDIS_OPERAND_ACTION_READ_CONDWRITE:
+			case ZYDIS_OPERAND_ACTION_CONDREAD_WRITE:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// The fields of a decoded operand that analysis looks at.
+	struct CompactOperand final {
+		ZydisOperandType type;
+		ZydisOperandVisibility visibility;
+		ZydisOperandAction action;
+		ZydisRegister reg; // The register for register operands, or the base register for memory operands.
+		ZydisRegister index;
+		ZydisU8 scale;
+		ZydisU16 size;
+		ZydisI64 value; // The value for immediate operands, or the displacement for memory operands.
+
+		// The address accessed by a memory operand with no base or index register, as an image address. See
+		// PEModule::fromImageAddress.
+		inline std::optional<Offset> absoluteAddress() const {
+			if (type != ZYDIS_OPERAND_TYPE_MEMORY) return std::nullopt;
+			if (reg != ZYDIS_REGISTER_NONE || index != ZYDIS_REGISTER_NONE) return std::nullopt;
+			return (Offset) (size_t) (uint32_t) value;
+		}
+	};
+
+	// How an instruction affects control flow, which is all that is needed to walk a function.
+	enum class InstructionFlow : uint8_t {
+		None, Call, ConditionalBranch, UnconditionalBranch, Return, Interrupt,
+	};
+
+	enum class IndirectBranchKind : uint8_t {
+		Unresolved,
+		JumpTable, // `jmp dword ptr [reg*4 + table]`, bounded by a `cmp` before it.
+		Import, // Through an entry in the import address table.
+		ImportThunk, // A direct call to a `jmp dword ptr [import]` thunk.
+		VirtualCall, // Through a slot of a vftable loaded from an object.
+	};
+	// A call or jump whose target isn't encoded in the instruction, classified by where the target comes from.
+	struct IndirectBranch final {
+		Offset address;
+		IndirectBranchKind kind;
+		Offset pointer; // The jump table or import address table entry, or NULL.
+		size_t vftableSlot; // For virtual calls.
+		std::vector<Offset> targets; // For jump tables, in table order without duplicates.
 	};
 
+	// A view of a single instruction in a ParsedFunction. Only valid while the function is.
 	struct DecodedInstruction final {
 		Offset instrAddress;
 		ZydisU8 length;
+		InstructionFlow flow;
 		ZydisMnemonic opcode;
 		ZydisInstructionCategory category;
+		Offset branchTarget;
+		ZydisU8 operandCount; // The number of entries in operands, at most ParsedFunction::kMaxOperands.
+		ZydisU8 totalOperandCount; // Including hidden operands and those that weren't kept.
+		const CompactOperand* operands;
 
-		DecodedInstruction() { }
-		DecodedInstruction(ZydisDecodedInstruction& instr);
-		inline ZydisDecodedInstruction decode() const;
+		// Runs the full decoder on the instruction again, for anything not kept in the compact form.
+		ZydisDecodedInstruction decode() const;
 	};
+
+	// The instructions of a function, sorted by address and stored as a struct of arrays. Parsing a function
+	// only needs the length and control flow of each instruction, which are found without the full decoder
+	// where possible. Everything else is decoded by Zydis the first time an instruction is looked at through
+	// instruction(), so only the instructions a search actually inspects pay for it. Because of this, a
+	// function must not be searched from several threads at once.
 	struct ParsedFunction final {
+		static const size_t kMaxOperands = 3;
+
 		Offset functionStart;
-		std::vector<DecodedInstruction> instructions;
-		ParsedFunction(Offset functionStart, std::vector<DecodedInstruction> instructions) :
-			functionStart(functionStart), instructions(instructions) { }
+
+		std::vector<Offset> addresses;
+		std::vector<ZydisU8> lengths;
+		std::vector<InstructionFlow> flows;
+		std::vector<Offset> branchTargets; // NULL when the instruction has no direct branch target.
+		// Every indirect call and jump, and every call to an import thunk, sorted by address. The targets of
+		// jump tables are part of the function.
+		std::vector<IndirectBranch> indirectBranches;
+
+		ParsedFunction(Offset functionStart) : functionStart(functionStart) { }
+
+		inline size_t size() const {
+			return addresses.size();
+		}
+		inline DecodedInstruction instruction(size_t i) const {
+			decodeDetail(i);
+			return { addresses[i], lengths[i], flows[i], mnemonics[i], categories[i], branchTargets[i],
+			         (ZydisU8) std::min((size_t) operandCounts[i], kMaxOperands), operandCounts[i],
+			         &operands[i * kMaxOperands] };
+		}
 
 		bool isOffsetInFunction(Offset offset) const;
 		size_t findInstructionsAfter(Offset offset) const;
+		const IndirectBranch* findIndirectBranch(Offset address) const;
 
 		std::vector<Offset> getCallOffsets(Offset after = NULL) const;
+		// The addresses of the call instructions whose targets getCallOffsets returns, in the same order.
+		std::vector<Offset> getCallSites(Offset after = NULL) const;
+		// Whether an instruction of the function starts at `site`, and is a direct call to `target`.
+		bool isCallTo(Offset site, Offset target) const;
 
 		template <typename Ret, typename Fn>
 		std::vector<Ret> findInstructions(Fn fn, const char* criteria0 = NULL, Offset after = NULL) const {
@@ -88,8 +280,8 @@ namespace aiModInternal {
 			DPRINT_LOW("  Searching for %s...", criteria);
 			std::vector<Ret> values;
 			auto idx = after ? findInstructionsAfter(after) : 0;
-			for (auto it = instructions.begin() + idx; it != instructions.end(); it++) {
-				std::optional<Ret> matches = fn(*it);
+			for (auto i = idx; i < size(); i++) {
+				std::optional<Ret> matches = fn(instruction(i));
 				if (matches.has_value()) values.push_back(std::move(*matches));
 			}
 			return values;
@@ -102,6 +294,15 @@ namespace aiModInternal {
 			if (list.size() != 1) reportFatalError("    Found more than %d %s.", list.size(), criteria);
 			return std::move(list[0]);
 		}
-	};
-}
 
+	private:
+		// Filled in by decodeDetail, and empty until an instruction is first inspected.
+		mutable std::vector<bool> detailDecoded;
+		mutable std::vector<ZydisMnemonic> mnemonics;
+		mutable std::vector<ZydisInstructionCategory> categories;
+		mutable std::vector<ZydisU8> operandCounts; // As decoded, so it may be more than kMaxOperands.
+		mutable std::vector<CompactOperand> operands; // kMaxOperands entries per instruction.
+
+		void decodeDetail(size_t i) const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <stdio.h>
+
+namespace aiModInternal {
+	static thread_local AnalysisStage* currentStage = NULL;
+
+#pragma region AnalysisStats
+	AnalysisStats& AnalysisStats::instance() {
+		static AnalysisStats stats;
+		return stats;
+	}
+
+	void AnalysisStats::record(const StageStats& stage) {
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& existing : stages) {
+			if (existing.name != stage.name) continue;
+			existing.runs += stage.runs;
+			existing.microseconds += stage.microseconds;
+			existing.bytesScanned += stage.bytesScanned;
+			existing.candidatesProduced += stage.candidatesProduced;
+			existing.candidatesRejected += stage.candidatesRejected;
+			return;
+		}
+		stages.push_back(stage);
+	}
+	std::vector<StageStats> AnalysisStats::getStages() {
+		std::lock_guard<std::mutex> guard(lock);
+		return stages;
+	}
+
+	static string escapeJson(const string& str) {
+		string escaped;
+		for (auto ch : str) {
+			if (ch == '"' || ch == '\\') escaped += '\\';
+			escaped += ch;
+		}
+		return escaped;
+	}
+	string AnalysisStats::toJson() {
+		string json = "[\n";
+		auto stages = getStages();
+		for (size_t i = 0; i < stages.size(); i++) {
+			auto& stage = stages[i];
+			json += str_format("  { \"stage\": \"%s\", \"runs\": %u, \"microseconds\": %llu, \"bytesScanned\": %llu, "
+			                   "\"candidatesProduced\": %llu, \"candidatesRejected\": %llu }%s\n",
+			                   escapeJson(stage.name).c_str(), stage.runs, stage.microseconds, stage.bytesScanned,
+			                   stage.candidatesProduced, stage.candidatesRejected, i + 1 < stages.size() ? "," : "");
+		}
+		json += "]\n";
+		return json;
+	}
+	string AnalysisStats::toCsv() {
+		string csv = "stage,runs,microseconds,bytes_scanned,candidates_produced,candidates_rejected\n";
+		for (auto& stage : getStages()) {
+			csv += str_format("\"%s\",%u,%llu,%llu,%llu,%llu\n", stage.name.c_str(), stage.runs, stage.microseconds,
+			                  stage.bytesScanned, stage.candidatesProduced, stage.candidatesRejected);
+		}
+		return csv;
+	}
+	void AnalysisStats::logTable() {
+		DPRINT_LOW("Analysis stages:");
+		DPRINT_LOW("  %-28s %6s %10s %12s %10s %10s", "Stage", "Runs", "Time (ms)", "Bytes", "Produced", "Rejected");
+		for (auto& stage : getStages()) {
+			DPRINT_LOW("  %-28s %6u %10.2f %12llu %10llu %10llu", stage.name.c_str(), stage.runs,
+			           stage.microseconds / 1000.0, stage.bytesScanned, stage.candidatesProduced, stage.candidatesRejected);
+		}
+	}
+	bool AnalysisStats::save(const string& path) {
+		auto isCsv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+		auto contents = isCsv ? toCsv() : toJson();
+		std::lock_guard<std::mutex> guard(saveLock);
+		auto file = fopen(path.c_str(), "wb");
+		if (!file) {
+			DPRINT_LOW("Could not write analysis stats to %s.", path.c_str());
+			return false;
+		}
+		fwrite(contents.data(), 1, contents.size(), file);
+		fclose(file);
+		return true;
+	}
+#pragma endregion
+
+#pragma region AnalysisStage
+	AnalysisStage::AnalysisStage(const char* name) : start(std::chrono::steady_clock::now()), outer(currentStage) {
+		stats.name = name;
+		stats.runs = 1;
+		currentStage = this;
+	}
+	AnalysisStage::~AnalysisStage() {
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		stats.microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		currentStage = outer;
+		if (outer) outer->stats.bytesScanned += stats.bytesScanned;
+		AnalysisStats::instance().record(stats);
+	}
+
+	void AnalysisStage::addBytesScanned(size_t bytes) {
+		if (currentStage) currentStage->stats.bytesScanned += bytes;
+	}
+#pragma endregion
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <core/Str.h>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace aiModInternal {
+	struct StageStats final {
+		string name;
+		uint32_t runs = 0;
+		uint64_t microseconds = 0;
+		uint64_t bytesScanned = 0;
+		uint64_t candidatesProduced = 0;
+		uint64_t candidatesRejected = 0;
+	};
+
+	// Counters for every analysis stage run by this process, merged by stage name. These are kept so scanner
+	// performance can be compared between builds of the game, and can be exported as JSON or CSV.
+	struct AnalysisStats final {
+		static AnalysisStats& instance();
+
+		void record(const StageStats& stage);
+		std::vector<StageStats> getStages();
+
+		string toJson();
+		string toCsv();
+		void logTable();
+		// Writes the stages to a file, as CSV if the path ends with .csv and as JSON otherwise. Saves from
+		// several threads are written one at a time.
+		bool save(const string& path);
+
+	private:
+		std::mutex lock;
+		std::mutex saveLock;
+		std::vector<StageStats> stages; // In the order they were first run.
+	};
+
+	// Times a stage of analysis and records it when it goes out of scope. Stages can be nested on a thread,
+	// in which case the time and bytes scanned of the inner stage are also part of the outer one. Bytes
+	// scanned are added to the innermost stage running on the calling thread.
+	struct AnalysisStage final {
+		AnalysisStage(const char* name);
+		AnalysisStage(const AnalysisStage&) = delete;
+		~AnalysisStage();
+
+		inline void produced(size_t count) {
+			stats.candidatesProduced += count;
+		}
+		inline void rejected(size_t count) {
+			stats.candidatesRejected += count;
+		}
+		static void addBytesScanned(size_t bytes);
+
+	private:
+		StageStats stats;
+		std::chrono::steady_clock::time_point start;
+		AnalysisStage* outer;
+	};
+}
@@ -0,0 +1,270 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "Benchmarks.h"
+#include "FastDecoder.h"
+#include "FunctionMap.h"
+#include "Scanner.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+namespace aiModInternal {
+	static void logTiming(const char* name, uint64_t microseconds, size_t bytes, size_t found) {
+		DPRINT_LOW("  %-40s %10.2f ms %9.1f MB/s %10d found", name, microseconds / 1000.0,
+		           (double) bytes / std::max(microseconds, (uint64_t) 1), found);
+	}
+
+	// Picks count items spread evenly over a list.
+	template <typename T> static std::vector<T> spread(const std::vector<T>& items, size_t count) {
+		if (items.size() <= count) return items;
+		std::vector<T> picked;
+		for (size_t i = 0; i < count; i++) picked.push_back(items[i * items.size() / count]);
+		return picked;
+	}
+
+#pragma region Needle scans
+	// Every occurrence of a needle, found the way Segment::findString did before the multi-pattern scanner.
+	static size_t countWithSearch(const Segment& segment, const string& needle) {
+		size_t found = 0;
+		auto begin = (const char*) segment.base, end = (const char*) (segment.base + segment.length);
+		while (true) {
+			auto match = std::search(begin, end, needle.begin(), needle.end());
+			if (match == end) return found;
+			found++;
+			begin = match + 1;
+		}
+	}
+
+	// Null-terminated runs of at least 8 printable characters, like most of the strings signatures start from.
+	static std::vector<string> findPrintableStrings(const Segment& segment) {
+		std::vector<string> strings;
+		size_t start = 0;
+		for (size_t i = 0; i < segment.length; i++) {
+			auto ch = segment.base[i];
+			if (ch >= 0x20 && ch < 0x7F) continue;
+			if (ch == 0 && i - start >= 8) strings.push_back(string((const char*) segment.base + start, i - start));
+			start = i + 1;
+		}
+		return strings;
+	}
+	// Aligned words in a segment that point into code, such as the entries of vftables.
+	static std::vector<uint32_t> findCodePointers(const PEModule& module, const Segment& segment, const Segment& code) {
+		std::vector<uint32_t> pointers;
+		for (size_t i = 0; i + 4 <= segment.length; i += 4) {
+			auto word = *(const uint32_t*) (segment.base + i);
+			if (code.containsOffset(module.fromImageAddress(word))) pointers.push_back(word);
+		}
+		std::sort(pointers.begin(), pointers.end());
+		pointers.erase(std::unique(pointers.begin(), pointers.end()), pointers.end());
+		return pointers;
+	}
+
+	// One pass of MultiPatternScanner over each segment, against a std::search loop for each needle and segment.
+	static void benchmarkNeedleScans(const PEModule& module) {
+		auto rdata = module.tryGetSegment(".rdata");
+		auto text = module.tryGetSegment(".text");
+		if (!rdata || !text) {
+			DPRINT_LOW("  Skipping the needle scans, which need .rdata and .text.");
+			return;
+		}
+		auto strings = spread(findPrintableStrings(*rdata), 6);
+		auto pointers = spread(findCodePointers(module, *rdata, *text), 50);
+		std::vector<string> needles = strings;
+		for (auto pointer : pointers) needles.push_back(string((const char*) &pointer, 4));
+		DPRINT_LOW("  %d strings and %d code pointers from .rdata.", strings.size(), pointers.size());
+
+		size_t bytes = 0;
+		for (auto& segment : module.getSegments()) bytes += segment.length;
+
+		size_t searchFound = 0, scannerFound = 0;
+		auto searchTime = timeBest([&]() {
+			searchFound = 0;
+			for (auto& segment : module.getSegments())
+				for (auto& needle : needles) searchFound += countWithSearch(segment, needle);
+		});
+		auto scannerTime = timeBest([&]() {
+			scannerFound = 0;
+			for (auto& segment : module.getSegments()) {
+				MultiPatternScanner scanner;
+				for (auto& str : strings) scanner.addString(str);
+				for (auto pointer : pointers) scanner.addOffset((Offset) (size_t) pointer);
+				for (auto& results : scanner.scan(segment)) scannerFound += results.size();
+			}
+		});
+		logTiming("std::search for each needle", searchTime, bytes, searchFound);
+		logTiming("MultiPatternScanner, one pass", scannerTime, bytes, scannerFound);
+	}
+#pragma endregion
+
+#pragma region Parsed functions
+	static const size_t kBenchmarkFunctions = 1000;
+
+	// Parsing functions from the starts in the FunctionMap, one at a time and as one parallel batch.
+	static void benchmarkFunctionParsing(const PEModule& module) {
+		std::vector<Offset> starts;
+		for (auto& function : module.functions().getFunctions())
+			if (module.containsOffset(function.start)) starts.push_back(function.start);
+		starts = spread(starts, kBenchmarkFunctions);
+		DPRINT_LOW("  Parsing %d functions from the function map.", starts.size());
+
+		size_t bytes = 0, serialFound = 0, batchFound = 0;
+		auto serialTime = timeBest([&]() {
+			bytes = serialFound = 0;
+			for (auto start : starts) {
+				auto function = module.parseFunctionByOffset(start);
+				if (!function.has_value()) continue;
+				serialFound++;
+				for (auto length : function->lengths) bytes += length;
+			}
+		});
+		auto batchTime = timeBest([&]() {
+			batchFound = 0;
+			for (auto& function : module.parseFunctionsByOffset(starts)) batchFound += function.has_value();
+		});
+		logTiming("parseFunctionByOffset for each start", serialTime, bytes, serialFound);
+		logTiming("parseFunctionsByOffset, one batch", batchTime, bytes, batchFound);
+	}
+
+	// A pass over every instruction of every function in .text looking for calls, once over the arrays of
+	// ParsedFunction and once over a ZydisDecodedInstruction for each instruction, as functions were kept before.
+	static void benchmarkInstructionLayout(const PEModule& module) {
+		std::vector<Offset> starts;
+		for (auto& function : module.functions().getFunctions())
+			if (module.containsOffset(function.start)) starts.push_back(function.start);
+		std::vector<ParsedFunction> functions;
+		for (auto& function : module.parseFunctionsByOffset(starts))
+			if (function.has_value()) functions.push_back(std::move(*function));
+
+		std::vector<ZydisDecodedInstruction> decoded;
+		size_t bytes = 0;
+		for (auto& function : functions) {
+			for (size_t i = 0; i < function.size(); i++) {
+				auto instr = module.decodeInstruction(function.addresses[i]);
+				if (instr.has_value()) decoded.push_back(*instr);
+				bytes += function.lengths[i];
+			}
+		}
+		DPRINT_LOW("  %d functions with %d instructions. %d bytes per decoded instruction, %d in the arrays.",
+		           functions.size(), decoded.size(), sizeof(ZydisDecodedInstruction),
+		           sizeof(Offset) * 2 + sizeof(ZydisU8) + sizeof(InstructionFlow));
+
+		size_t decodedFound = 0, arraysFound = 0;
+		auto decodedTime = timeBest([&]() {
+			decodedFound = 0;
+			for (auto& instr : decoded) decodedFound += instr.meta.category == ZYDIS_CATEGORY_CALL;
+		});
+		auto arraysTime = timeBest([&]() {
+			arraysFound = 0;
+			for (auto& function : functions)
+				for (auto flow : function.flows) arraysFound += flow == InstructionFlow::Call;
+		});
+		logTiming("Calls from ZydisDecodedInstruction", decodedTime, bytes, decodedFound);
+		logTiming("Calls from ParsedFunction::flows", arraysTime, bytes, arraysFound);
+	}
+
+	// A linear sweep over .text that only finds the length of each instruction, once with Zydis alone and once
+	// with decodeBounds, falling back to Zydis as function parsing does. Bytes that don't decode are skipped.
+	static void benchmarkDecoders(const PEModule& module) {
+		auto text = module.tryGetSegment(".text");
+		if (!text) {
+			DPRINT_LOW("  Skipping the decoders, which need .text.");
+			return;
+		}
+		ZydisDecoder decoder;
+		ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_COMPAT_32, ZYDIS_ADDRESS_WIDTH_32);
+		auto zydisLength = [&](Offset offset, size_t remaining) -> size_t {
+			ZydisDecodedInstruction instr;
+			auto status = ZydisDecoderDecodeBuffer(&decoder, (const void*) offset, remaining, (ZydisU64) offset, &instr);
+			return ZYDIS_SUCCESS(status) ? instr.length : 1;
+		};
+
+		size_t zydisFound = 0, fastFound = 0, fastHandled = 0;
+		auto zydisTime = timeBest([&]() {
+			zydisFound = 0;
+			for (size_t i = 0; i < text->length; zydisFound++) i += zydisLength(text->base + i, text->length - i);
+		});
+		auto fastTime = timeBest([&]() {
+			fastFound = fastHandled = 0;
+			for (size_t i = 0; i < text->length; fastFound++) {
+				auto bounds = decodeBounds(text->base + i, text->length - i);
+				if (bounds.has_value()) fastHandled++;
+				i += bounds.has_value() ? bounds->length : zydisLength(text->base + i, text->length - i);
+			}
+		});
+		logTiming("Linear decode, Zydis", zydisTime, text->length, zydisFound);
+		logTiming("Linear decode, decodeBounds and Zydis", fastTime, text->length, fastFound);
+		DPRINT_LOW("  decodeBounds handled %.1f%% of the instructions.", 100.0 * fastHandled / std::max(fastFound, (size_t) 1));
+	}
+#pragma endregion
+
+#pragma region Pattern scans
+	// Common shapes of MSVC code, from very common to rare.
+	static const char* const kBenchmarkPatterns[] = {
+		"CC CC 55 8B EC",
+		"E8 ?? ?? ?? ?? 83 C4 ??",
+		"8B 0D ?? ?? ?? ?? E8",
+		"68 ?? ?? ?? ?? E8 ?? ?? ?? ?? 83 C4 04",
+		"55 8B EC 6A FF 68 ?? ?? ?? ?? 64 A1 00 00 00 00",
+		"E8 ?? ?? ?? ?? 8B 0D ?? ?? ?? ?? 85 C9",
+	};
+
+	// Every match of a pattern, found with std::search and a predicate that skips wildcards.
+	static size_t countWithSearch(const Segment& segment, const BytePattern& pattern) {
+		std::vector<int16_t> needle;
+		for (size_t i = 0; i < pattern.size(); i++) needle.push_back(pattern.mask[i] ? pattern.bytes[i] : -1);
+		auto matches = [](uint8_t byte, int16_t expected) { return expected < 0 || byte == expected; };
+		size_t found = 0;
+		auto begin = segment.base, end = segment.base + segment.length;
+		while (true) {
+			auto match = std::search(begin, end, needle.begin(), needle.end(), matches);
+			if (match == end) return found;
+			found++;
+			begin = match + 1;
+		}
+	}
+
+	// The patterns above in .text, with std::search and with MaskedPatternScanner using each supported kernel.
+	static void benchmarkPatternScans(const PEModule& module) {
+		auto text = module.tryGetSegment(".text");
+		if (!text) {
+			DPRINT_LOW("  Skipping the pattern scans, which need .text.");
+			return;
+		}
+		std::vector<BytePattern> patterns;
+		for (auto pattern : kBenchmarkPatterns) patterns.push_back(BytePattern::parse(pattern));
+
+		size_t searchFound = 0;
+		auto searchTime = timeBest([&]() {
+			searchFound = 0;
+			for (auto& pattern : patterns) searchFound += countWithSearch(*text, pattern);
+		});
+		logTiming("std::search for each pattern", searchTime, text->length, searchFound);
+
+		for (auto kernel : { ScanKernel::Scalar, ScanKernel::Sse2, ScanKernel::Avx2 }) {
+			if (!isScanKernelSupported(kernel)) {
+				DPRINT_LOW("  The %s kernel isn't supported here.", scanKernelName(kernel));
+				continue;
+			}
+			size_t found = 0;
+			auto time = timeBest([&]() {
+				found = 0;
+				MaskedPatternScanner scanner(kernel);
+				for (auto& pattern : patterns) scanner.addPattern(pattern);
+				for (auto& results : scanner.scan(*text)) found += results.size();
+			});
+			logTiming(str_format("MaskedPatternScanner, %s", scanKernelName(kernel)).c_str(), time, text->length, found);
+		}
+	}
+#pragma endregion
+
+	void runAnalysisBenchmarks(const PEModule& module) {
+		DPRINT_LOW("Benchmarking %s, fastest of %d runs:", module.name(), kBenchmarkRuns);
+		benchmarkNeedleScans(module);
+		benchmarkFunctionParsing(module);
+		benchmarkInstructionLayout(module);
+		benchmarkDecoders(module);
+		benchmarkPatternScans(module);
+	}
+}
\ No newline at end of file
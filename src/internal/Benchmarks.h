@@ -0,0 +1,34 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <algorithm>
+#include <chrono>
+
+struct AI;
+
+namespace aiModInternal {
+	static const int kBenchmarkRuns = 5;
+
+	// The fastest of a few runs of fn, in microseconds.
+	template <typename Fn> uint64_t timeBest(Fn fn) {
+		uint64_t best = UINT64_MAX;
+		for (int run = 0; run < kBenchmarkRuns; run++) {
+			auto start = std::chrono::steady_clock::now();
+			fn();
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			best = std::min(best, (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+		}
+		return best;
+	}
+
+	// Times the analysis code against the straightforward code it replaced, on the sections of an image, e.g. the
+	// game's executable. Each benchmark keeps the fastest of a few runs and logs how much each side found, so the
+	// two can be checked to agree. `AnalysisRunner --benchmark <image>` runs these outside of the game.
+	void runAnalysisBenchmarks(const PEModule& module);
+	// Times a steering kernel over synthetic ships, run per ship from separately allocated actions, and run once
+	// over packed ActionBatchInputs. Then times the same kernel as a BatchedAction with members created for the
+	// AI: adding them, and the per-ship update calls of each step, which include the gather. It needs the game's
+	// AI, so ActionBenchmarkMod runs it in game.
+	void runActionBenchmarks(AI* ai);
+}
@@ -0,0 +1,212 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "DataFlow.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace aiModInternal {
+	static const int ESP_INDEX = ZYDIS_REGISTER_ESP - ZYDIS_REGISTER_EAX;
+	static const int EAX_INDEX = ZYDIS_REGISTER_EAX - ZYDIS_REGISTER_EAX;
+	static const int ECX_INDEX = ZYDIS_REGISTER_ECX - ZYDIS_REGISTER_EAX;
+	static const int EDX_INDEX = ZYDIS_REGISTER_EDX - ZYDIS_REGISTER_EAX;
+
+	// The general purpose register containing a register, or -1.
+	static int registerIndex(ZydisRegister reg) {
+		if (reg >= ZYDIS_REGISTER_EAX && reg <= ZYDIS_REGISTER_EDI) return reg - ZYDIS_REGISTER_EAX;
+		if (reg >= ZYDIS_REGISTER_AX && reg <= ZYDIS_REGISTER_DI) return reg - ZYDIS_REGISTER_AX;
+		if (reg >= ZYDIS_REGISTER_AL && reg <= ZYDIS_REGISTER_BH) return (reg - ZYDIS_REGISTER_AL) & 3;
+		return -1;
+	}
+	static bool isStackOperand(const CompactOperand& operand) {
+		return operand.type == ZYDIS_OPERAND_TYPE_MEMORY && operand.reg == ZYDIS_REGISTER_ESP &&
+		       operand.index == ZYDIS_REGISTER_NONE;
+	}
+
+	// The values known at one point in a function. The top of the stack is at the back.
+	struct DataFlowState final {
+		TrackedValue registers[8];
+		std::vector<TrackedValue> stack;
+		size_t argumentsPushed = 0; // Slots added since the last call, which __stdcall and __thiscall callees pop.
+
+		void forget() {
+			for (auto& value : registers) value = TrackedValue();
+			for (auto& value : stack) value = TrackedValue();
+		}
+		void forgetStack() {
+			stack.clear();
+			argumentsPushed = 0;
+		}
+		TrackedValue* stackSlot(ZydisI64 displacement) {
+			if (displacement < 0 || displacement % 4 || (size_t) (displacement / 4) >= stack.size()) return NULL;
+			return &stack[stack.size() - 1 - displacement / 4];
+		}
+		void push(TrackedValue value) {
+			stack.push_back(value);
+			argumentsPushed++;
+		}
+		TrackedValue pop() {
+			if (argumentsPushed) argumentsPushed--;
+			if (stack.empty()) return TrackedValue();
+			auto value = stack.back();
+			stack.pop_back();
+			return value;
+		}
+
+		TrackedValue read(const CompactOperand& operand) {
+			switch (operand.type) {
+				case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+					return { ValueSource::Immediate, (uint32_t) operand.value, NULL };
+				case ZYDIS_OPERAND_TYPE_REGISTER: {
+					auto index = registerIndex(operand.reg);
+					if (index < 0 || operand.size != 32) return TrackedValue();
+					return registers[index];
+				}
+				case ZYDIS_OPERAND_TYPE_MEMORY: {
+					if (operand.size != 32) return TrackedValue();
+					auto address = operand.absoluteAddress();
+					if (address.has_value()) return { ValueSource::Load, (uint32_t) (size_t) *address, NULL };
+					auto slot = isStackOperand(operand) ? stackSlot(operand.value) : NULL;
+					return slot ? *slot : TrackedValue();
+				}
+				default:
+					return TrackedValue();
+			}
+		}
+		void write(const CompactOperand& operand, TrackedValue value) {
+			if (operand.type == ZYDIS_OPERAND_TYPE_REGISTER) {
+				auto index = registerIndex(operand.reg);
+				if (index == ESP_INDEX) forgetStack();
+				else if (index >= 0) registers[index] = operand.size == 32 ? value : TrackedValue();
+			} else if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY && isStackOperand(operand)) {
+				auto slot = stackSlot(operand.value);
+				if (slot) *slot = operand.size == 32 ? value : TrackedValue();
+			}
+		}
+		// Forgets everything an instruction that isn't understood writes to.
+		void clobber(const DecodedInstruction& instr) {
+			auto kept = std::min((size_t) instr.operandCount, ParsedFunction::kMaxOperands);
+			for (size_t i = 0; i < kept; i++) {
+				if (isWriteAction(instr.operands[i].action)) write(instr.operands[i], TrackedValue());
+			}
+			if (instr.totalOperandCount <= ParsedFunction::kMaxOperands) return;
+
+			// Only the first few operands are kept, so the rest are found by decoding the instruction again.
+			auto full = instr.decode();
+			for (size_t i = ParsedFunction::kMaxOperands; i < full.operandCount; i++) {
+				auto& operand = full.operands[i];
+				if (!isWriteAction(operand.action)) continue;
+				if (operand.type == ZYDIS_OPERAND_TYPE_REGISTER) {
+					auto index = registerIndex(operand.reg.value);
+					if (index == ESP_INDEX) forgetStack();
+					else if (index >= 0) registers[index] = TrackedValue();
+				} else if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY && operand.mem.base == ZYDIS_REGISTER_ESP) {
+					forget();
+				}
+			}
+		}
+	};
+
+	// Applies an instruction other than a call. afterCall is set for the instruction right after a call,
+	// where an `add esp, n` removes the arguments of a __cdecl function, which were already popped.
+	static void step(DataFlowState& state, const DecodedInstruction& instr, bool afterCall) {
+		auto operands = instr.operands;
+		switch (instr.opcode) {
+			case ZYDIS_MNEMONIC_PUSH:
+				if (operands[0].size != 32 && operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE) break;
+				state.push(state.read(operands[0]));
+				return;
+			case ZYDIS_MNEMONIC_POP:
+				state.write(operands[0], state.pop());
+				return;
+			case ZYDIS_MNEMONIC_MOV:
+				state.write(operands[0], state.read(operands[1]));
+				return;
+			case ZYDIS_MNEMONIC_LEA: {
+				auto address = operands[1].absoluteAddress();
+				TrackedValue value;
+				if (address.has_value()) value = { ValueSource::Immediate, (uint32_t) (size_t) *address, NULL };
+				state.write(operands[0], value);
+				return;
+			}
+			case ZYDIS_MNEMONIC_XOR:
+			case ZYDIS_MNEMONIC_SUB:
+				if (operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER && operands[1].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+				    operands[0].reg == operands[1].reg) {
+					state.write(operands[0], { ValueSource::Immediate, 0, NULL });
+					return;
+				}
+				// Fall through, for `sub esp, n`.
+			case ZYDIS_MNEMONIC_ADD: {
+				if (instr.opcode == ZYDIS_MNEMONIC_XOR) break;
+				if (operands[0].type != ZYDIS_OPERAND_TYPE_REGISTER || operands[0].reg != ZYDIS_REGISTER_ESP) break;
+				if (operands[1].type != ZYDIS_OPERAND_TYPE_IMMEDIATE) break;
+				// Large frames are left to clobber, which forgets the stack.
+				if (operands[1].value <= 0 || operands[1].value > 0x100 || operands[1].value % 4) break;
+				auto slots = (size_t) (operands[1].value / 4);
+				if (instr.opcode == ZYDIS_MNEMONIC_SUB) {
+					for (size_t i = 0; i < slots; i++) state.push(TrackedValue());
+				} else if (!afterCall) {
+					for (size_t i = 0; i < slots; i++) state.pop();
+				}
+				return;
+			}
+		}
+		state.clobber(instr);
+	}
+
+	std::vector<CallSite> findCallSites(const ParsedFunction& function, Offset after) {
+		// Values can't be followed into an instruction reached from more than one place.
+		std::unordered_set<Offset> branchTargets;
+		for (size_t i = 0; i < function.size(); i++) {
+			if (function.flows[i] != InstructionFlow::Call && function.branchTargets[i])
+				branchTargets.insert(function.branchTargets[i]);
+		}
+		for (auto& branch : function.indirectBranches) branchTargets.insert(branch.targets.begin(), branch.targets.end());
+
+		std::vector<CallSite> sites;
+		auto first = after ? function.findInstructionsAfter(after) : 0;
+		DataFlowState state;
+		auto afterCall = false;
+		for (size_t i = 0; i < function.size(); i++) {
+			auto previousFlow = i ? function.flows[i - 1] : InstructionFlow::None;
+			if (previousFlow == InstructionFlow::UnconditionalBranch || previousFlow == InstructionFlow::Return ||
+			    previousFlow == InstructionFlow::Interrupt) {
+				state.forget();
+			} else if (branchTargets.find(function.addresses[i]) != branchTargets.end()) {
+				state.forget();
+			}
+
+			auto instr = function.instruction(i);
+			if (instr.flow != InstructionFlow::Call) {
+				step(state, instr, afterCall);
+				afterCall = false;
+				continue;
+			}
+
+			if (i >= first) {
+				CallSite site;
+				site.address = instr.instrAddress;
+				site.target = instr.branchTarget;
+				site.thisValue = state.registers[ECX_INDEX];
+				site.argumentCount = std::min(state.stack.size(), CallSite::kMaxArguments);
+				for (size_t j = 0; j < site.argumentCount; j++) site.arguments[j] = state.stack[state.stack.size() - 1 - j];
+				sites.push_back(site);
+			}
+
+			// The callee pops its arguments unless it's __cdecl, and may change EAX, ECX and EDX.
+			state.stack.resize(state.stack.size() - std::min(state.argumentsPushed, state.stack.size()));
+			state.argumentsPushed = 0;
+			state.registers[EAX_INDEX] = TrackedValue();
+			if (instr.branchTarget)
+				state.registers[EAX_INDEX] = { ValueSource::CallResult, 0, instr.branchTarget, instr.instrAddress };
+			state.registers[ECX_INDEX] = TrackedValue();
+			state.registers[EDX_INDEX] = TrackedValue();
+			afterCall = true;
+		}
+		return sites;
+	}
+}
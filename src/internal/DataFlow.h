@@ -0,0 +1,40 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <vector>
+
+namespace aiModInternal {
+	enum class ValueSource : uint8_t {
+		Unknown,
+		Immediate, // A constant, e.g. `push 10h` or `mov ecx, offset Foo`.
+		Load, // Loaded from an absolute address, e.g. `mov ecx, dword ptr [Foo]`.
+		CallResult, // Returned in EAX by a direct call.
+	};
+	struct TrackedValue final {
+		ValueSource source = ValueSource::Unknown;
+		uint32_t value = 0; // The constant, or the image address loaded from.
+		Offset callTarget = NULL; // The function that returned the value.
+		Offset callAddress = NULL; // The call instruction that returned it.
+	};
+
+	// A call made by a function, with the values it was passed. `this` is passed in ECX by __thiscall and
+	// __fastcall functions, so thisValue is only meaningful for calls to them.
+	struct CallSite final {
+		static const size_t kMaxArguments = 8;
+
+		Offset address;
+		Offset target; // NULL for indirect calls.
+		TrackedValue thisValue;
+		// The stack arguments, with the value on top of the stack (the first argument) first. Values pushed or
+		// stored below the arguments are also listed, as the number of arguments isn't known.
+		TrackedValue arguments[kMaxArguments];
+		size_t argumentCount;
+	};
+
+	// Follows constants, loads from absolute addresses and call results through the general purpose registers
+	// and the slots pushed onto the stack, in one forward pass over a function. Values are forgotten at branch
+	// targets, since they could be reached with other values, and when they are overwritten by anything that
+	// isn't understood. Returns every call made after an offset, like ParsedFunction::getCallOffsets.
+	std::vector<CallSite> findCallSites(const ParsedFunction& function, Offset after = NULL);
+}
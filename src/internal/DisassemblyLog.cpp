@@ -0,0 +1,151 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "DisassemblyLog.h"
+#include "ExportIndex.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <string.h>
+
+namespace aiModInternal {
+	std::atomic<bool> DisassemblyLog::enabled(false);
+
+#pragma region Formatting
+	// Names an offset after the closest export at or before it, like PEModule::describeOffset, but only in the same
+	// segment and without allocating.
+	static bool formatSymbol(const PEModule& module, Offset offset, char* out, size_t size) {
+		auto segment = module.segmentForOffset(offset);
+		if (!segment.has_value()) return false;
+		auto symbol = module.exports().findNearest(offset);
+		if (!symbol.has_value() || !segment->containsOffset(symbol->offset)) return false;
+		if (symbol->offset == offset) snprintf(out, size, "%s", symbol->name);
+		else snprintf(out, size, "%s+0x%x", symbol->name, (uint32_t) (offset - symbol->offset));
+		return true;
+	}
+
+	static ZydisFormatterAddressFunc defaultPrintAddress = NULL;
+	static ZydisStatus printAddress(const ZydisFormatter* formatter, ZydisString* string,
+	                                const ZydisDecodedInstruction* instr, const ZydisDecodedOperand* operand,
+	                                ZydisU64 address, void* userData) {
+		auto& module = *(const PEModule*) userData;
+		// Instructions are decoded at their offset, so branch targets are offsets, while absolute memory operands
+		// hold an image address.
+		auto offset = operand->type == ZYDIS_OPERAND_TYPE_MEMORY ? module.fromImageAddress((uint32_t) address)
+		                                                         : (Offset) (size_t) address;
+		char name[256];
+		if (!formatSymbol(module, offset, name, sizeof(name)))
+			return defaultPrintAddress(formatter, string, instr, operand, address, userData);
+		return ZydisStringAppendC(string, name);
+	}
+
+	static const char* describeIndirectBranch(const IndirectBranch& branch, char* out, size_t size) {
+		switch (branch.kind) {
+			case IndirectBranchKind::JumpTable:
+				snprintf(out, size, "  ; jump table with %d targets", (int) branch.targets.size());
+				return out;
+			case IndirectBranchKind::Import: return "  ; import";
+			case IndirectBranchKind::ImportThunk: return "  ; import thunk";
+			case IndirectBranchKind::VirtualCall:
+				snprintf(out, size, "  ; vftable slot %d", (int) branch.vftableSlot);
+				return out;
+			default: return "";
+		}
+	}
+#pragma endregion
+
+#pragma region DisassemblyLog
+	DisassemblyLog::DisassemblyLog() {
+		ZydisFormatterInit(&formatter, ZYDIS_FORMATTER_STYLE_INTEL);
+		const void* hook = (const void*) &printAddress;
+		ZydisFormatterSetHook(&formatter, ZYDIS_FORMATTER_HOOK_PRINT_ADDRESS, &hook);
+		defaultPrintAddress = (ZydisFormatterAddressFunc) hook;
+	}
+	DisassemblyLog& DisassemblyLog::instance() {
+		static DisassemblyLog log;
+		return log;
+	}
+
+	bool DisassemblyLog::open(const string& path) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (file) {
+			flush();
+			fclose(file);
+		}
+		file = fopen(path.c_str(), "ab");
+		enabled.store(file != NULL, std::memory_order_relaxed);
+		if (!file) DPRINT_LOW("Could not open disassembly log %s.", path.c_str());
+		return file != NULL;
+	}
+	void DisassemblyLog::close() {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!file) return;
+		enabled.store(false, std::memory_order_relaxed);
+		flush();
+		fclose(file);
+		file = NULL;
+	}
+
+	// Returns space for one line at the end of the buffer, which is written out first if needed.
+	char* DisassemblyLog::reserveLine() {
+		if (used + kMaxLineLength > kBufferSize) {
+			fwrite(buffer, 1, used, file);
+			used = 0;
+		}
+		return buffer + used;
+	}
+	void DisassemblyLog::flush() {
+		fwrite(buffer, 1, used, file);
+		fflush(file);
+		used = 0;
+	}
+
+	void DisassemblyLog::note(const char* text) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!file) return;
+		auto line = reserveLine();
+		auto length = snprintf(line, kMaxLineLength, "%s\n", text);
+		used += std::min((size_t) length, kMaxLineLength - 1);
+		flush();
+	}
+
+	void DisassemblyLog::dumpFunction(const PEModule& module, const ParsedFunction& function) {
+		// Leaves room after the instruction for a comment.
+		static const size_t kMaxCommentLength = 64;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!file) return;
+		char name[256];
+		if (!formatSymbol(module, function.functionStart, name, sizeof(name))) snprintf(name, sizeof(name), "sub_%08X",
+			module.toImageAddress(function.functionStart));
+		auto line = reserveLine();
+		used += std::min((size_t) snprintf(line, kMaxLineLength, "\n%s: (%d instructions)\n", name,
+		                                   (int) function.size()), kMaxLineLength - 1);
+
+		for (size_t i = 0; i < function.size(); i++) {
+			auto address = function.addresses[i];
+			line = reserveLine();
+			auto length = (size_t) snprintf(line, kMaxLineLength, "  %08X  ", module.toImageAddress(address));
+
+			auto instr = module.decodeInstruction(address);
+			auto formatLength = kMaxLineLength - length - kMaxCommentLength;
+			if (!instr.has_value() ||
+			    !ZYDIS_SUCCESS(ZydisFormatterFormatInstructionEx(&formatter, &*instr, line + length, formatLength,
+			                                                     (void*) &module))) {
+				snprintf(line + length, formatLength, "(invalid)");
+			}
+			length += strlen(line + length);
+
+			auto branch = function.findIndirectBranch(address);
+			if (branch) {
+				char comment[kMaxCommentLength];
+				snprintf(line + length, kMaxCommentLength - 1, "%s", describeIndirectBranch(*branch, comment, sizeof(comment)));
+				length += strlen(line + length);
+			}
+			line[length++] = '\n';
+			used += length;
+		}
+		flush();
+	}
+#pragma endregion
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <Zydis/Zydis.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+
+namespace aiModInternal {
+	// Writes annotated disassembly to a log file, for working out why a signature stopped matching a new build
+	// of the game. Instructions are formatted straight into a fixed buffer that is flushed to the file when it
+	// fills up, and addresses are named after the closest export, so a dump doesn't allocate per instruction.
+	// Nothing is formatted until a log is opened, and callers should check isEnabled before collecting anything
+	// to dump.
+	struct DisassemblyLog final {
+		static const size_t kBufferSize = 64 * 1024;
+		static const size_t kMaxLineLength = 512;
+
+		static DisassemblyLog& instance();
+		static inline bool isEnabled() {
+			return enabled.load(std::memory_order_relaxed);
+		}
+
+		// Appends to the log at a path, replacing any log that was already open.
+		bool open(const string& path);
+		void close();
+
+		// Writes a line of text, e.g. why the functions that follow are being dumped.
+		void note(const char* text);
+		void dumpFunction(const PEModule& module, const ParsedFunction& function);
+
+	private:
+		static std::atomic<bool> enabled;
+
+		std::mutex lock;
+		FILE* file = NULL;
+		ZydisFormatter formatter;
+		char buffer[kBufferSize];
+		size_t used = 0;
+
+		DisassemblyLog();
+		char* reserveLine();
+		void flush();
+	};
+}
@@ -0,0 +1,75 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "ExportIndex.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+namespace aiModInternal {
+	ExportIndex::ExportIndex(const PEModule& module) : imageBase(module.imageBase()) {
+		directory = module.getDataDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+	}
+
+	void ExportIndex::load() {
+		std::call_once(loaded, [this]() { loadImpl(); });
+	}
+	void ExportIndex::loadImpl() {
+		if (!directory.Size) return;
+
+		auto exports = (IMAGE_EXPORT_DIRECTORY*) (imageBase + directory.VirtualAddress);
+		auto names = (uint32_t*) (imageBase + exports->AddressOfNames);
+		auto ordinals = (uint16_t*) (imageBase + exports->AddressOfNameOrdinals);
+		auto functions = (uint32_t*) (imageBase + exports->AddressOfFunctions);
+
+		// Forwarded exports point to a string in the export directory rather than code in this module.
+		auto isForwarded = [&](uint32_t rva) {
+			return rva >= directory.VirtualAddress && rva < directory.VirtualAddress + directory.Size;
+		};
+
+		ordinalBase = exports->Base;
+		byOrdinal.assign(exports->NumberOfFunctions, ExportSymbol { NULL, 0, NULL });
+		for (uint32_t i = 0; i < exports->NumberOfFunctions; i++) {
+			byOrdinal[i].ordinal = ordinalBase + i;
+			if (functions[i] && !isForwarded(functions[i])) byOrdinal[i].offset = imageBase + functions[i];
+		}
+
+		for (uint32_t i = 0; i < exports->NumberOfNames; i++) {
+			auto index = ordinals[i];
+			if (index >= exports->NumberOfFunctions || !byOrdinal[index].offset) continue;
+			byOrdinal[index].name = (const char*) (imageBase + names[i]);
+			symbols.push_back(byOrdinal[index]);
+		}
+		std::sort(symbols.begin(), symbols.end(),
+		          [](const ExportSymbol& a, const ExportSymbol& b) { return strcmp(a.name, b.name) < 0; });
+
+		for (uint32_t i = 0; i < symbols.size(); i++) byOffset.push_back(i);
+		std::sort(byOffset.begin(), byOffset.end(),
+		          [&](uint32_t a, uint32_t b) { return symbols[a].offset < symbols[b].offset; });
+
+		DPRINT_LOW("Indexed %d named exports and %d ordinals.", symbols.size(), byOrdinal.size());
+	}
+
+	std::optional<ExportSymbol> ExportIndex::findByName(const char* name) {
+		load();
+		auto bound = std::lower_bound(symbols.begin(), symbols.end(), name,
+		                              [](const ExportSymbol& symbol, const char* name) { return strcmp(symbol.name, name) < 0; });
+		if (bound == symbols.end() || strcmp(bound->name, name) != 0) return std::nullopt;
+		return *bound;
+	}
+	std::optional<ExportSymbol> ExportIndex::findByOrdinal(uint32_t ordinal) {
+		load();
+		if (ordinal < ordinalBase || ordinal - ordinalBase >= byOrdinal.size()) return std::nullopt;
+		auto& symbol = byOrdinal[ordinal - ordinalBase];
+		if (!symbol.offset) return std::nullopt;
+		return symbol;
+	}
+	std::optional<ExportSymbol> ExportIndex::findNearest(Offset offset) {
+		load();
+		auto bound = std::upper_bound(byOffset.begin(), byOffset.end(), offset,
+		                              [&](Offset offset, uint32_t index) { return offset < symbols[index].offset; });
+		if (bound == byOffset.begin()) return std::nullopt;
+		return symbols[*(bound - 1)];
+	}
+}
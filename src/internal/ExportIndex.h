@@ -0,0 +1,43 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace aiModInternal {
+	struct ExportSymbol final {
+		const char* name;
+		uint32_t ordinal;
+		Offset offset;
+	};
+
+	// The exports of a module, read from its export directory the first time they are needed. Exports can be
+	// looked up by name, by ordinal, or by offset, which finds the closest export at or before that offset.
+	struct ExportIndex final {
+		ExportIndex(const PEModule& module);
+		ExportIndex(const ExportIndex&) = delete;
+
+		std::optional<ExportSymbol> findByName(const char* name);
+		std::optional<ExportSymbol> findByOrdinal(uint32_t ordinal);
+		std::optional<ExportSymbol> findNearest(Offset offset);
+		inline size_t size() {
+			load();
+			return symbols.size();
+		}
+
+	private:
+		Offset imageBase;
+		IMAGE_DATA_DIRECTORY directory;
+
+		std::once_flag loaded;
+		std::vector<ExportSymbol> symbols; // Sorted by name.
+		std::vector<ExportSymbol> byOrdinal; // Indexed by ordinal - ordinalBase. The offset is NULL for unused ordinals.
+		std::vector<uint32_t> byOffset; // Indices into symbols, sorted by offset.
+		uint32_t ordinalBase = 0;
+
+		void load();
+		void loadImpl();
+	};
+}
@@ -0,0 +1,240 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "FastDecoder.h"
+#include "Macros.h"
+#include "Utils.h"
+
+namespace aiModInternal {
+	// The operands following an opcode. Opcodes marked X are left to Zydis, as are opcodes whose ModRM.reg
+	// selects an instruction that isn't handled, which is checked separately below.
+	enum : uint8_t {
+		N = 0,
+		M = 0x01, // A ModRM byte, with an optional SIB byte and displacement.
+		B = 0x02, // An 8 bit immediate.
+		W = 0x04, // A 16 bit immediate.
+		Z = 0x08, // A 32 bit immediate, or 16 bits with an operand size prefix.
+		D = 0x10, // A 32 bit address.
+		F3 = 0x20, // A REP prefix is allowed as a mandatory prefix.
+		F2 = 0x40, // A REPNE prefix is allowed as a mandatory prefix.
+		X = 0x80,
+		MB = M | B,
+		MZ = M | Z,
+		WB = W | B,
+		MR = M | F3 | F2,
+		M3 = M | F3,
+	};
+
+	static const uint8_t oneByteOperands[256] = {
+		/*       0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
+		/* 0 */  M,  M,  M,  M,  B,  Z,  N,  N,  M,  M,  M,  M,  B,  Z,  N,  X,
+		/* 1 */  M,  M,  M,  M,  B,  Z,  N,  N,  M,  M,  M,  M,  B,  Z,  N,  N,
+		/* 2 */  M,  M,  M,  M,  B,  Z,  X,  N,  M,  M,  M,  M,  B,  Z,  X,  N,
+		/* 3 */  M,  M,  M,  M,  B,  Z,  X,  N,  M,  M,  M,  M,  B,  Z,  X,  N,
+		/* 4 */  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,
+		/* 5 */  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,
+		/* 6 */  N,  N,  X,  M,  X,  X,  X,  X,  Z, MZ,  B, MB,  N,  N,  N,  N,
+		/* 7 */  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,
+		/* 8 */ MB, MZ,  X, MB,  M,  M,  M,  M,  M,  M,  M,  M,  X,  M,  X,  X,
+		/* 9 */  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  X,  N,  N,  N,  N,  N,
+		/* A */  D,  D,  D,  D,  N,  N,  N,  N,  B,  Z,  N,  N,  N,  N,  N,  N,
+		/* B */  B,  B,  B,  B,  B,  B,  B,  B,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,
+		/* C */ MB, MB,  W,  N,  X,  X, MB, MZ, WB,  N,  X,  X,  N,  B,  N,  X,
+		/* D */  M,  M,  M,  M,  B,  B,  X,  N,  M,  M,  M,  M,  M,  M,  M,  M,
+		/* E */  X,  X,  X,  X,  B,  B,  B,  B,  Z,  Z,  X,  B,  N,  N,  N,  N,
+		/* F */  X,  X,  X,  X,  N,  N,  M,  M,  N,  N,  N,  N,  N,  N,  M,  M,
+	};
+	static const uint8_t twoByteOperands[256] = {
+		/*       0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
+		/* 0 */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+		/* 1 */ MR, MR,  X,  X,  M,  M,  X,  X,  X,  X,  X,  X,  X,  X,  X,  M,
+		/* 2 */  X,  X,  X,  X,  X,  X,  X,  X,  M,  M, MR,  X, MR, MR,  M,  M,
+		/* 3 */  X,  N,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+		/* 4 */  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+		/* 5 */  X, MR,  X,  X,  M,  M,  M,  M, MR, MR, MR,  X, MR, MR, MR, MR,
+		/* 6 */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  M, M3,
+		/* 7 */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X, M3, M3,
+		/* 8 */  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,
+		/* 9 */  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+		/* A */  X,  X,  N,  M,  MB, M,  X,  X,  X,  X,  X,  M, MB,  M,  X,  M,
+		/* B */  M,  M,  X,  M,  X,  X,  M,  M,  X,  X,  X,  M,  X,  X,  M,  M,
+		/* C */  M,  M,  X,  X,  X,  X, MB,  X,  N,  N,  N,  N,  N,  N,  N,  N,
+		/* D */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+		/* E */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  M,
+		/* F */  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+	};
+
+	// The length of a ModRM byte and everything following it, with 32 bit addressing.
+	static size_t modRmLength(const uint8_t* modRm, size_t remaining) {
+		auto mod = modRm[0] >> 6, rm = modRm[0] & 7;
+		if (mod == 3) return 1;
+		size_t length = 1;
+		if (rm == 4) {
+			if (remaining < 2) return 0;
+			length++;
+			if (mod == 0 && (modRm[1] & 7) == 5) return length + 4;
+		}
+		if (mod == 0) return rm == 5 ? length + 4 : length;
+		return length + (mod == 1 ? 1 : 4);
+	}
+
+	// Whether the ModRM.reg field selects an instruction handled here, for opcodes that depend on it.
+	static bool isHandledOneByteForm(uint8_t opcode, uint8_t modRm) {
+		auto mod = modRm >> 6, reg = (modRm >> 3) & 7;
+		switch (opcode) {
+			case 0x8D: return mod != 3;
+			case 0xC6: case 0xC7: return reg == 0;
+			case 0xF6: case 0xF7: return reg != 1;
+			case 0xFE: return reg <= 1;
+			case 0xFF: return reg != 3 && reg != 5 && reg != 7;
+			case 0xD8: case 0xD9: case 0xDA: case 0xDB: case 0xDC: case 0xDD: case 0xDE: case 0xDF:
+				if (mod == 3) return false;
+				if (opcode == 0xD9 && reg == 1) return false;
+				if (opcode == 0xDB && (reg == 4 || reg == 6)) return false;
+				if (opcode == 0xDD && reg == 5) return false;
+				return true;
+		}
+		return true;
+	}
+	static bool isHandledTwoByteForm(uint8_t opcode, uint8_t modRm) {
+		auto reg = (modRm >> 3) & 7;
+		if (opcode == 0x1F || (opcode >= 0x90 && opcode <= 0x9F)) return reg == 0;
+		return true;
+	}
+
+	template <typename T> static T readValue(Offset offset) {
+		T value;
+		memcpy(&value, offset, sizeof(T));
+		return value;
+	}
+
+	std::optional<InstructionBounds> decodeBounds(Offset offset, size_t remaining) {
+		static const size_t kMaxLength = 15;
+		if (remaining > kMaxLength) remaining = kMaxLength;
+
+		// Legacy prefixes. Lock prefixes and address size overrides are rare and have extra rules, so they are
+		// left to Zydis.
+		size_t i = 0;
+		bool operandSize = false, rep = false, repne = false;
+		for (;; i++) {
+			if (i >= remaining) return std::nullopt;
+			auto byte = offset[i];
+			if (byte == 0x66) operandSize = true;
+			else if (byte == 0xF3) rep = true;
+			else if (byte == 0xF2) repne = true;
+			else if (byte == 0x26 || byte == 0x2E || byte == 0x36 || byte == 0x3E || byte == 0x64 || byte == 0x65) continue;
+			else if (byte == 0xF0 || byte == 0x67) return std::nullopt;
+			else break;
+		}
+
+		auto opcode = offset[i++];
+		auto twoByte = opcode == 0x0F;
+		if (twoByte) {
+			if (i >= remaining) return std::nullopt;
+			opcode = offset[i++];
+		}
+
+		auto operands = twoByte ? twoByteOperands[opcode] : oneByteOperands[opcode];
+		if (operands & X) return std::nullopt;
+		if (twoByte) {
+			if (rep && repne) return std::nullopt;
+			if ((rep || repne) && operandSize) return std::nullopt;
+			if (rep && !(operands & F3)) return std::nullopt;
+			if (repne && !(operands & F2)) return std::nullopt;
+		}
+
+		auto modRm = offset + i;
+		if (operands & M) {
+			if (i >= remaining) return std::nullopt;
+			if (!(twoByte ? isHandledTwoByteForm(opcode, *modRm) : isHandledOneByteForm(opcode, *modRm))) return std::nullopt;
+			auto length = modRmLength(modRm, remaining - i);
+			if (!length) return std::nullopt;
+			i += length;
+		}
+		if (!twoByte && (opcode == 0xF6 || opcode == 0xF7) && ((*modRm >> 3) & 7) == 0)
+			operands |= opcode == 0xF6 ? B : Z;
+		if (operands & B) i += 1;
+		if (operands & W) i += 2;
+		if (operands & Z) i += operandSize ? 2 : 4;
+		if (operands & D) i += 4;
+		if (i > remaining) return std::nullopt;
+
+		InstructionBounds bounds = { (ZydisU8) i, InstructionFlow::None, NULL };
+		auto next = offset + i;
+		if (twoByte) {
+			if (opcode >= 0x80 && opcode <= 0x8F) {
+				if (operandSize) return std::nullopt;
+				bounds.flow = InstructionFlow::ConditionalBranch;
+				bounds.branchTarget = next + readValue<int32_t>(next - 4);
+			}
+			return bounds;
+		}
+		switch (opcode) {
+			case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+			case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+				if (operandSize) return std::nullopt;
+				bounds.flow = InstructionFlow::ConditionalBranch;
+				bounds.branchTarget = next + readValue<int8_t>(next - 1);
+				break;
+			case 0xEB:
+				if (operandSize) return std::nullopt;
+				bounds.flow = InstructionFlow::UnconditionalBranch;
+				bounds.branchTarget = next + readValue<int8_t>(next - 1);
+				break;
+			case 0xE8:
+			case 0xE9:
+				if (operandSize) return std::nullopt;
+				bounds.flow = opcode == 0xE8 ? InstructionFlow::Call : InstructionFlow::UnconditionalBranch;
+				bounds.branchTarget = next + readValue<int32_t>(next - 4);
+				break;
+			case 0xC2:
+			case 0xC3:
+				bounds.flow = InstructionFlow::Return;
+				break;
+			case 0xCC:
+			case 0xCD:
+			case 0xCE:
+				bounds.flow = InstructionFlow::Interrupt;
+				break;
+			case 0xFF: {
+				auto mod = *modRm >> 6, reg = (*modRm >> 3) & 7, rm = *modRm & 7;
+				if (reg != 2 && reg != 4) break;
+				if (operandSize) return std::nullopt;
+				bounds.flow = reg == 2 ? InstructionFlow::Call : InstructionFlow::UnconditionalBranch;
+				// Zydis gives the address of the pointer for an absolute memory operand, and nothing for others.
+				if (mod == 0 && rm == 5) bounds.branchTarget = (Offset) (size_t) readValue<uint32_t>(modRm + 1);
+				else if (mod != 3 && rm == 4) return std::nullopt;
+				break;
+			}
+		}
+		return bounds;
+	}
+
+	static string formatBounds(const std::optional<InstructionBounds>& bounds) {
+		if (!bounds.has_value()) return "rejected";
+		return str_format("length %d, flow %d, target 0x%p", bounds->length, (int) bounds->flow, bounds->branchTarget);
+	}
+	size_t checkDecodeBounds(const Segment& segment) {
+		static const size_t kMaxLogged = 16;
+		size_t checked = 0, mismatches = 0;
+		for (size_t i = 0; i < segment.length; i++) {
+			auto offset = segment.base + i;
+			auto fast = decodeBounds(offset, segment.length - i);
+			if (!fast.has_value()) continue;
+			checked++;
+			auto zydis = decodeBoundsWithZydis(offset, segment.length - i);
+			if (zydis.has_value() && zydis->length == fast->length && zydis->flow == fast->flow &&
+			    zydis->branchTarget == fast->branchTarget) continue;
+
+			if (mismatches++ < kMaxLogged) {
+				string bytes;
+				for (size_t j = 0; j < std::min((size_t) 15, segment.length - i); j++) bytes += str_format("%02x ", offset[j]);
+				DPRINT_LOW("  decodeBounds disagrees with Zydis at 0x%p (%s): %s, against %s.", offset, bytes.c_str(),
+				           formatBounds(fast).c_str(), formatBounds(zydis).c_str());
+			}
+		}
+		DPRINT_LOW("  decodeBounds accepted %d offsets in %s, and disagreed with Zydis on %d.", checked,
+		           segment.name.c_str(), mismatches);
+		return mismatches;
+	}
+}
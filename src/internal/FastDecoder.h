@@ -0,0 +1,27 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <optional>
+
+namespace aiModInternal {
+	struct InstructionBounds final {
+		ZydisU8 length;
+		InstructionFlow flow;
+		Offset branchTarget; // Computed the same way as ZydisCalcAbsoluteAddress, or NULL.
+	};
+
+	// Finds the length, control flow and branch target of a 32-bit x86 instruction from lookup tables, without
+	// running the full decoder. Only the integer, x87 and SSE forms common in compiled code are handled. For
+	// anything else, including instructions Zydis would reject, this returns nullopt and the instruction must
+	// be decoded with Zydis instead.
+	std::optional<InstructionBounds> decodeBounds(Offset offset, size_t remaining);
+	// The same bounds, found by Zydis for any instruction it decodes.
+	std::optional<InstructionBounds> decodeBoundsWithZydis(Offset offset, size_t remaining);
+
+	// Runs decodeBounds at every byte of a segment, and compares each instruction it accepts against
+	// decodeBoundsWithZydis. Logs the instructions they disagree on, and returns how many there are. Function
+	// parsing trusts decodeBounds, so any disagreement could end in an ASSERT_FATAL when an instruction is
+	// decoded in full later.
+	size_t checkDecodeBounds(const Segment& segment);
+}
@@ -0,0 +1,118 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "FunctionMap.h"
+#include "XrefIndex.h"
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+namespace aiModInternal {
+	static const size_t FUNCTION_ALIGNMENT = 0x10;
+
+	// The layout of an exception directory entry.
+	struct RuntimeFunction {
+		uint32_t beginAddress;
+		uint32_t endAddress;
+		uint32_t unwindData;
+	};
+
+	FunctionMap::FunctionMap(const PEModule& module, std::shared_ptr<XrefIndex> xrefs) : xrefs(xrefs) {
+		text = module.getSegment(".text");
+		imageBase = module.imageBase();
+		exceptionDirectory = module.getDataDirectory(IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+
+		// The entries are read in place by buildImpl, so the whole directory has to be inside the image.
+		if (!exceptionDirectory.Size) return;
+		auto start = module.fromRva(exceptionDirectory.VirtualAddress);
+		module.boundsCheck(start);
+		auto segment = *module.segmentForOffset(start);
+		if (exceptionDirectory.Size > (size_t) (segment.base + segment.length - start)) {
+			auto str = segment.toString();
+			reportFatalError("Exception directory at 0x%p with size 0x%x overruns %s", start, exceptionDirectory.Size,
+			                 str.c_str());
+		}
+	}
+
+	void FunctionMap::build() {
+		std::call_once(built, [this]() { buildImpl(); });
+	}
+	void FunctionMap::buildImpl() {
+		DPRINT_LOW("Building function map for segment %s...", text.name.c_str());
+
+		// Find aligned offsets following padding. These are kept separately, as findPotentialEntries also
+		// returns offsets inside the padding itself.
+		auto end = text.base + text.length;
+		auto offset = (Offset) (((size_t) text.base + FUNCTION_ALIGNMENT - 1) & ~(FUNCTION_ALIGNMENT - 1));
+		for (; offset < end; offset += FUNCTION_ALIGNMENT)
+			if (offset == text.base || *(offset - 1) == 0xCC) paddingStarts.push_back(offset);
+		AnalysisStage::addBytesScanned(text.length);
+
+		std::vector<FunctionRange> exact;
+		auto entryCount = exceptionDirectory.Size / sizeof(RuntimeFunction);
+		auto entries = (RuntimeFunction*) (imageBase + exceptionDirectory.VirtualAddress);
+		for (size_t i = 0; i < entryCount; i++) {
+			FunctionRange range = { imageBase + entries[i].beginAddress, imageBase + entries[i].endAddress };
+			if (text.containsOffset(range.start) && range.end > range.start && range.end <= end) exact.push_back(range);
+		}
+
+		std::vector<Offset> starts;
+		for (auto start : paddingStarts) if (*start != 0xCC) starts.push_back(start);
+		auto callTargets = xrefs->callTargets(2);
+		starts.insert(starts.end(), callTargets.begin(), callTargets.end());
+		for (auto& range : exact) starts.push_back(range.start);
+		std::sort(starts.begin(), starts.end());
+		starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+		std::sort(exact.begin(), exact.end(), [](const FunctionRange& a, const FunctionRange& b) { return a.start < b.start; });
+		auto nextExact = exact.begin();
+		for (size_t i = 0; i < starts.size(); i++) {
+			auto start = starts[i];
+			// Starts inside a function with a known range are not functions of their own.
+			if (!functions.empty() && start < functions.back().end) continue;
+
+			while (nextExact != exact.end() && nextExact->start < start) nextExact++;
+			if (nextExact != exact.end() && nextExact->start == start) {
+				functions.push_back(*nextExact);
+				continue;
+			}
+
+			auto functionEnd = i + 1 < starts.size() ? starts[i + 1] : end;
+			while (functionEnd > start + 1 && *(functionEnd - 1) == 0xCC) functionEnd--;
+			functions.push_back({ start, functionEnd });
+		}
+
+		DPRINT_LOW("  Found %d functions. (%d exception directory entries, %d call targets)",
+		           functions.size(), exact.size(), callTargets.size());
+	}
+
+	std::vector<Offset> FunctionMap::findPotentialEntries(Offset offset, size_t maxInstructions) {
+		text.boundsCheck(offset);
+		ASSERT_FATAL((maxInstructions & 0xF) == 0);
+		build();
+
+		auto max = (Offset) ((size_t) offset & ~(FUNCTION_ALIGNMENT - 1));
+		auto min = (size_t) (max - text.base) > maxInstructions ? max - maxInstructions : text.base;
+		auto first = std::lower_bound(paddingStarts.begin(), paddingStarts.end(), min);
+		auto last = std::upper_bound(first, paddingStarts.end(), max);
+
+		std::vector<Offset> offsets(std::make_reverse_iterator(last), std::make_reverse_iterator(first));
+		DPRINT_LOW("  Found %d potential function entry points.", offsets.size());
+		return offsets;
+	}
+	std::optional<FunctionRange> FunctionMap::findFunction(Offset offset) {
+		build();
+		auto bound = std::upper_bound(functions.begin(), functions.end(), offset,
+		                              [](Offset offset, const FunctionRange& range) { return offset < range.start; });
+		if (bound == functions.begin()) return std::nullopt;
+		bound--;
+		if (offset >= bound->end) return std::nullopt;
+		return *bound;
+	}
+	const std::vector<FunctionRange>& FunctionMap::getFunctions() {
+		build();
+		return functions;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace aiModInternal {
+	struct FunctionRange final {
+		Offset start;
+		Offset end;
+	};
+
+	// The functions in a module's .text segment, found by a single linear sweep the first time they are needed.
+	//
+	// Function starts are combined from three sources:
+	// * Exception directory entries, when the module has them. These also give the exact end of the function.
+	// * Offsets aligned by 0x10 bytes that follow 0xCC padding, which is how MSVC lays out functions.
+	// * Targets of `call rel32` instructions with at least two call sites.
+	// A function without an exception directory entry is assumed to end at the next function start, with any
+	// trailing padding removed.
+	struct FunctionMap final {
+		FunctionMap(const PEModule& module, std::shared_ptr<XrefIndex> xrefs);
+		FunctionMap(const FunctionMap&) = delete;
+
+		// Offsets that may be the entry point of a function containing the given offset, starting with the
+		// closest one. Only offsets at most maxInstructions bytes before the offset are considered.
+		std::vector<Offset> findPotentialEntries(Offset offset, size_t maxInstructions);
+		std::optional<FunctionRange> findFunction(Offset offset);
+		const std::vector<FunctionRange>& getFunctions();
+
+	private:
+		Segment text;
+		Offset imageBase;
+		IMAGE_DATA_DIRECTORY exceptionDirectory;
+		std::shared_ptr<XrefIndex> xrefs;
+
+		std::once_flag built;
+		std::vector<Offset> paddingStarts; // Sorted.
+		std::vector<FunctionRange> functions; // Sorted, and never overlapping.
+
+		void build();
+		void buildImpl();
+	};
+}
@@ -20,6 +20,11 @@
 	auto listAsStr = ::aiModInternal::formatList(format, var); \
 	DPRINT_LOW("  " #var " = %s", listAsStr.c_str()); \
 }
+// Needs DisassemblyLog.h. The arguments aren't evaluated unless a disassembly log is open.
+#define ANALYSIS_DBG_DISASSEMBLY(module, function) do { \
+	if (::aiModInternal::DisassemblyLog::isEnabled()) \
+		::aiModInternal::DisassemblyLog::instance().dumpFunction(module, function); \
+} while (0)
 
 #define ENUM_TO_STR_SIMPLE_CASE(s, v) case v: return #s;
 #define ENUM_TO_STR_FN(fnName, Type, T) static const char* fnName(Type t) { \
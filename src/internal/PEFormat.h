@@ -0,0 +1,82 @@
+#pragma once
+
+// The PE32 structures used by PEModule. On Windows these come from the platform headers. Elsewhere, the subset
+// needed to read an image from disk is declared here, so analysis can run on files outside of the game.
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <stdint.h>
+
+typedef void* HMODULE;
+
+#define IMAGE_DOS_SIGNATURE 0x5A4D
+#define IMAGE_NT_SIGNATURE 0x00004550
+#define IMAGE_NT_OPTIONAL_HDR32_MAGIC 0x10b
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES 16
+#define IMAGE_SIZEOF_SHORT_NAME 8
+#define IMAGE_DIRECTORY_ENTRY_EXPORT 0
+#define IMAGE_DIRECTORY_ENTRY_EXCEPTION 3
+#define IMAGE_DIRECTORY_ENTRY_BASERELOC 5
+#define IMAGE_DIRECTORY_ENTRY_IAT 12
+#define IMAGE_REL_BASED_HIGHLOW 3
+
+struct IMAGE_DOS_HEADER {
+	uint16_t e_magic;
+	uint16_t e_unused[29];
+	int32_t e_lfanew;
+};
+struct IMAGE_FILE_HEADER {
+	uint16_t Machine;
+	uint16_t NumberOfSections;
+	uint32_t TimeDateStamp;
+	uint32_t PointerToSymbolTable;
+	uint32_t NumberOfSymbols;
+	uint16_t SizeOfOptionalHeader;
+	uint16_t Characteristics;
+};
+struct IMAGE_DATA_DIRECTORY {
+	uint32_t VirtualAddress;
+	uint32_t Size;
+};
+struct IMAGE_OPTIONAL_HEADER32 {
+	uint16_t Magic;
+	uint8_t MajorLinkerVersion, MinorLinkerVersion;
+	uint32_t SizeOfCode, SizeOfInitializedData, SizeOfUninitializedData;
+	uint32_t AddressOfEntryPoint, BaseOfCode, BaseOfData, ImageBase;
+	uint32_t SectionAlignment, FileAlignment;
+	uint16_t MajorOperatingSystemVersion, MinorOperatingSystemVersion;
+	uint16_t MajorImageVersion, MinorImageVersion;
+	uint16_t MajorSubsystemVersion, MinorSubsystemVersion;
+	uint32_t Win32VersionValue, SizeOfImage, SizeOfHeaders, CheckSum;
+	uint16_t Subsystem, DllCharacteristics;
+	uint32_t SizeOfStackReserve, SizeOfStackCommit, SizeOfHeapReserve, SizeOfHeapCommit;
+	uint32_t LoaderFlags, NumberOfRvaAndSizes;
+	IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+};
+struct IMAGE_NT_HEADERS32 {
+	uint32_t Signature;
+	IMAGE_FILE_HEADER FileHeader;
+	IMAGE_OPTIONAL_HEADER32 OptionalHeader;
+};
+struct IMAGE_SECTION_HEADER {
+	uint8_t Name[IMAGE_SIZEOF_SHORT_NAME];
+	union {
+		uint32_t PhysicalAddress;
+		uint32_t VirtualSize;
+	} Misc;
+	uint32_t VirtualAddress, SizeOfRawData, PointerToRawData;
+	uint32_t PointerToRelocations, PointerToLinenumbers;
+	uint16_t NumberOfRelocations, NumberOfLinenumbers;
+	uint32_t Characteristics;
+};
+struct IMAGE_BASE_RELOCATION {
+	uint32_t VirtualAddress;
+	uint32_t SizeOfBlock;
+};
+struct IMAGE_EXPORT_DIRECTORY {
+	uint32_t Characteristics, TimeDateStamp;
+	uint16_t MajorVersion, MinorVersion;
+	uint32_t Name, Base, NumberOfFunctions, NumberOfNames;
+	uint32_t AddressOfFunctions, AddressOfNames, AddressOfNameOrdinals;
+};
+#endif
@@ -0,0 +1,105 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "PerceptionCache.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace aiModInternal {
+	// Sensor ranges are a few cells across, and most cells hold a fleet at most.
+	static const float kCellSize = 1000.f;
+
+#pragma region PerceptionSnapshot
+	PerceptionSnapshot::Cell PerceptionSnapshot::cellOf(float2 position) {
+		return { (int) floorf(position.x / kCellSize), (int) floorf(position.y / kCellSize) };
+	}
+	bool PerceptionSnapshot::findCell(uint64_t key, size_t* start, size_t* end) const {
+		auto it = std::lower_bound(cellKeys.begin(), cellKeys.end(), key);
+		if (it == cellKeys.end() || *it != key) return false;
+		auto index = it - cellKeys.begin();
+		*start = cellStarts[index];
+		*end = cellStarts[index + 1];
+		return true;
+	}
+
+	void PerceptionSnapshot::build(GameZone* zone) {
+		// Subclusters move with the cluster they're attached to, so only the top level is kept.
+		sortScratch.clear();
+		for (auto cluster : zone->getClusters()) {
+			if (!exist(cluster) || cluster->parent) continue;
+			auto cell = cellOf(cluster->getPos());
+			sortScratch.push_back({ cellKey(cell.x, cell.y), cluster });
+		}
+		// Clusters keep the zone's order within a cell, so query results don't depend on where they're allocated.
+		std::stable_sort(sortScratch.begin(), sortScratch.end(),
+		                 [](const std::pair<uint64_t, const BlockCluster*>& a,
+		                    const std::pair<uint64_t, const BlockCluster*>& b) { return a.first < b.first; });
+
+		clusters.clear();
+		commands.clear();
+		positions.clear();
+		velocities.clear();
+		radii.clear();
+		factions.clear();
+		deadliness.clear();
+		cellKeys.clear();
+		cellStarts.clear();
+		maxRadius = 0.f;
+		for (auto& entry : sortScratch) {
+			auto cluster = entry.second;
+			if (cellKeys.empty() || cellKeys.back() != entry.first) {
+				cellKeys.push_back(entry.first);
+				cellStarts.push_back((uint32_t) clusters.size());
+			}
+			clusters.push_back(cluster);
+			commands.push_back(cluster->command);
+			positions.push_back(cluster->getPos());
+			velocities.push_back(cluster->getVel());
+			radii.push_back(cluster->getBRadius());
+			factions.push_back(cluster->m_faction);
+			deadliness.push_back(cluster->getDeadliness());
+			maxRadius = std::max(maxRadius, cluster->getBRadius());
+		}
+		cellStarts.push_back((uint32_t) clusters.size());
+	}
+
+	void PerceptionSnapshot::findNear(float2 center, float radius, std::vector<uint32_t>& out) const {
+		out.clear();
+		visitNear(center, radius, [&](size_t i) { out.push_back((uint32_t) i); });
+	}
+	void PerceptionSnapshot::findEnemies(float2 center, float radius, Faction_t faction,
+	                                     std::vector<uint32_t>& out) const {
+		out.clear();
+		visitNear(center, radius, [&](size_t i) {
+			if (commands[i] && factions[i] != faction) out.push_back((uint32_t) i);
+		});
+	}
+	void PerceptionSnapshot::findAllies(float2 center, float radius, Faction_t faction,
+	                                    std::vector<uint32_t>& out) const {
+		out.clear();
+		visitNear(center, radius, [&](size_t i) {
+			if (commands[i] && factions[i] == faction) out.push_back((uint32_t) i);
+		});
+	}
+#pragma endregion
+
+#pragma region PerceptionCache
+	PerceptionCache& PerceptionCache::instance() {
+		static PerceptionCache cache;
+		return cache;
+	}
+
+	const PerceptionSnapshot& PerceptionCache::get(GameZone* zone) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (zone != this->zone || zone->simStep != simStep) {
+			snapshot.build(zone);
+			this->zone = zone;
+			simStep = zone->simStep;
+		}
+		return snapshot;
+	}
+#pragma endregion
+}
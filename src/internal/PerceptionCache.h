@@ -0,0 +1,93 @@
+#pragma once
+
+#include <game/Blocks.h>
+#include <game/GameZone.h>
+
+#include <mutex>
+#include <vector>
+
+namespace aiModInternal {
+	// Every ship and piece of debris in a game zone at one step, as a struct of arrays sorted into the cells of a
+	// uniform grid. Index i of each array belongs to the same cluster, and the clusters in a cell are next to each
+	// other, so a neighbour query reads a few short runs of packed data instead of the zone's spatial hashes.
+	// The pointers are only valid during the step the snapshot was built in.
+	struct PerceptionSnapshot final {
+		std::vector<const BlockCluster*> clusters;
+		std::vector<const Block*> commands; // NULL for debris.
+		std::vector<float2> positions;
+		std::vector<float2> velocities;
+		std::vector<float> radii;
+		std::vector<Faction_t> factions;
+		std::vector<int> deadliness;
+
+		inline size_t size() const {
+			return clusters.size();
+		}
+
+		void build(GameZone* zone);
+
+		// Calls fn(i) for every cluster whose bounding circle overlaps a circle.
+		template <typename Fn> void visitNear(float2 center, float radius, Fn fn) const {
+			auto reach = radius + maxRadius;
+			auto low = cellOf(center - float2(reach));
+			auto high = cellOf(center + float2(reach));
+			auto cellCount = ((int64_t) high.x - low.x + 1) * ((int64_t) high.y - low.y + 1);
+			if (cellCount >= (int64_t) cellKeys.size()) {
+				for (size_t i = 0; i < size(); i++)
+					if (overlaps(i, center, radius)) fn(i);
+				return;
+			}
+			for (auto y = low.y; y <= high.y; y++) {
+				for (auto x = low.x; x <= high.x; x++) {
+					size_t start, end;
+					if (!findCell(cellKey(x, y), &start, &end)) continue;
+					for (auto i = start; i < end; i++)
+						if (overlaps(i, center, radius)) fn(i);
+				}
+			}
+		}
+		// The indices of the clusters near a circle, in no particular order.
+		void findNear(float2 center, float radius, std::vector<uint32_t>& out) const;
+		// Ships of any other faction, or of the faction, near a circle.
+		void findEnemies(float2 center, float radius, Faction_t faction, std::vector<uint32_t>& out) const;
+		void findAllies(float2 center, float radius, Faction_t faction, std::vector<uint32_t>& out) const;
+
+	private:
+		struct Cell {
+			int x;
+			int y;
+		};
+
+		std::vector<uint64_t> cellKeys; // Sorted.
+		std::vector<uint32_t> cellStarts; // The first cluster in each cell, followed by the number of clusters.
+		float maxRadius = 0.f;
+		std::vector<std::pair<uint64_t, const BlockCluster*>> sortScratch;
+
+		static Cell cellOf(float2 position);
+		static inline uint64_t cellKey(int x, int y) {
+			return ((uint64_t) (uint32_t) x << 32) | (uint32_t) y;
+		}
+		bool findCell(uint64_t key, size_t* start, size_t* end) const;
+		inline bool overlaps(size_t i, float2 center, float radius) const {
+			auto delta = positions[i] - center;
+			auto reach = radius + radii[i];
+			return delta.x * delta.x + delta.y * delta.y <= reach * reach;
+		}
+	};
+
+	// A snapshot of the zone for each step, shared by every mod AI. The snapshot is built by the first call in a
+	// step, and the calls after it only read it, so it can also be queried from ParallelAction::evaluate.
+	struct PerceptionCache final {
+		static PerceptionCache& instance();
+
+		const PerceptionSnapshot& get(GameZone* zone);
+
+	private:
+		std::mutex lock;
+		PerceptionSnapshot snapshot;
+		GameZone* zone = NULL;
+		uint simStep = 0;
+
+		PerceptionCache() { }
+	};
+}
@@ -0,0 +1,127 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "ResolverSuite.h"
+#include "Analysis.h"
+#include "AnalysisCore.h"
+#include "FastDecoder.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace aiModInternal {
+#pragma region Corpus
+	static bool isAbsolutePath(const string& path) {
+		return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+	}
+	static string trim(const string& str) {
+		auto start = str.find_first_not_of(" \t\r\n");
+		if (start == string::npos) return "";
+		auto end = str.find_last_not_of(" \t\r\n");
+		return str.substr(start, end - start + 1);
+	}
+
+	std::vector<ResolverCase> loadResolverCorpus(const string& manifestPath) {
+		auto file = fopen(manifestPath.c_str(), "rb");
+		if (!file) reportFatalError("Could not open resolver corpus %s.", manifestPath.c_str());
+		auto separator = manifestPath.find_last_of("/\\");
+		auto directory = separator == string::npos ? "" : manifestPath.substr(0, separator + 1);
+
+		std::vector<ResolverCase> corpus;
+		char buffer[1024];
+		for (int lineNumber = 1; fgets(buffer, sizeof(buffer), file); lineNumber++) {
+			auto line = trim(buffer);
+			if (line.empty() || line[0] == '#') continue;
+			auto split = line.find_first_of(" \t");
+			auto key = line.substr(0, split);
+			auto value = split == string::npos ? "" : trim(line.substr(split));
+			if (value.empty()) reportFatalError("Missing value on line %d of %s.", lineNumber, manifestPath.c_str());
+
+			if (key == "image") {
+				corpus.push_back({ isAbsolutePath(value) ? value : directory + value, {} });
+				continue;
+			}
+			if (corpus.empty()) reportFatalError("Expected an image on line %d of %s.", lineNumber, manifestPath.c_str());
+			if (value == "-") {
+				corpus.back().expectedRvas[key] = std::nullopt;
+				continue;
+			}
+			char* end;
+			auto rva = strtoul(value.c_str(), &end, 0);
+			if (*end) reportFatalError("Invalid RVA %s on line %d of %s.", value.c_str(), lineNumber, manifestPath.c_str());
+			corpus.back().expectedRvas[key] = (uint32_t) rva;
+		}
+		fclose(file);
+		return corpus;
+	}
+#pragma endregion
+
+#pragma region Suite
+	std::vector<ResolverResult> runResolverSuite(const std::vector<ResolverCase>& corpus) {
+		std::vector<ResolverResult> results;
+		for (auto& resolverCase : corpus) {
+			DPRINT_LOW("Running resolvers on %s...", resolverCase.imagePath.c_str());
+			PEModule module(resolverCase.imagePath);
+			for (auto& pair : resolveAllOffsets(module)) {
+				ResolverResult result;
+				result.imagePath = resolverCase.imagePath;
+				result.name = pair.first;
+				result.rva = pair.second.rva;
+				result.microseconds = pair.second.microseconds;
+				result.memoryBytes = pair.second.memoryBytes;
+
+				auto expected = resolverCase.expectedRvas.find(pair.first);
+				result.checked = expected != resolverCase.expectedRvas.end();
+				if (result.checked) result.expectedRva = expected->second;
+				result.passed = !result.checked || result.rva == result.expectedRva;
+				results.push_back(result);
+			}
+			auto text = module.tryGetSegment(".text");
+			if (text.has_value()) {
+				ResolverResult result;
+				result.imagePath = resolverCase.imagePath;
+				result.name = "decodeBounds";
+				result.checked = true;
+				auto start = std::chrono::steady_clock::now();
+				result.passed = checkDecodeBounds(*text) == 0;
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				result.microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+				result.memoryBytes = 0;
+				results.push_back(result);
+			}
+			for (auto& expected : resolverCase.expectedRvas) {
+				bool found = false;
+				for (auto& result : results) found |= result.imagePath == resolverCase.imagePath && result.name == expected.first;
+				if (!found) DPRINT_LOW("  Warning: No resolver is named %s.", expected.first.c_str());
+			}
+		}
+		return results;
+	}
+
+	static string formatRva(const std::optional<uint32_t>& rva) {
+		return rva.has_value() ? str_format("0x%x", *rva) : "-";
+	}
+	bool logResolverResults(const std::vector<ResolverResult>& results) {
+		size_t failed = 0;
+		string imagePath;
+		for (auto& result : results) {
+			if (result.imagePath != imagePath) {
+				imagePath = result.imagePath;
+				DPRINT_LOW("%s:", imagePath.c_str());
+				DPRINT_LOW("  %-24s %-6s %10s %10s %10s %12s", "Resolver", "Result", "RVA", "Expected", "Time (ms)",
+				           "Memory (KB)");
+			}
+			auto status = !result.checked ? "-" : result.passed ? "PASS" : "FAIL";
+			DPRINT_LOW("  %-24s %-6s %10s %10s %10.2f %12lld", result.name.c_str(), status, formatRva(result.rva).c_str(),
+			           result.checked ? formatRva(result.expectedRva).c_str() : "", result.microseconds / 1000.0,
+			           (long long) (result.memoryBytes / 1024));
+			if (!result.passed) failed++;
+		}
+		DPRINT_LOW("%d of %d resolvers failed.", failed, results.size());
+		return failed == 0;
+	}
+#pragma endregion
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <core/Str.h>
+
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace aiModInternal {
+	// An image of the game and the RVAs the resolvers are expected to find in it. Resolvers that are expected
+	// to fail have no RVA, and resolvers that aren't listed are timed but not checked.
+	struct ResolverCase final {
+		string imagePath;
+		std::map<string, std::optional<uint32_t>> expectedRvas;
+	};
+	struct ResolverResult final {
+		string imagePath;
+		string name;
+		std::optional<uint32_t> rva;
+		std::optional<uint32_t> expectedRva;
+		bool checked;
+		bool passed;
+		uint64_t microseconds;
+		int64_t memoryBytes;
+	};
+
+	// Reads a corpus manifest. Each case starts with an `image` line, followed by the expected RVA of each
+	// resolver, or `-` if it should fail. Image paths are relative to the manifest, e.g.:
+	//
+	//     # Reassembly 2019-04-29
+	//     image Reassembly-2019-04-29.exe
+	//     Notifier::instance 0x1a2b30
+	//     globals 0x4c8d10
+	//     CVarBase::index -
+	std::vector<ResolverCase> loadResolverCorpus(const string& manifestPath);
+
+	// Loads every image in a corpus from disk and runs every resolver in Analysis.cpp against it, without the
+	// analysis cache. The images don't need to be the running game. `AnalysisRunner <manifest>` runs this
+	// outside of the game, and fixtures/corpus.txt is a synthetic image to run it on. Each image also gets a
+	// `decodeBounds` result, which fails if checkDecodeBounds finds an instruction it disagrees with Zydis on.
+	std::vector<ResolverResult> runResolverSuite(const std::vector<ResolverCase>& corpus);
+	// Logs a table of results and returns whether every checked resolver passed.
+	bool logResolverResults(const std::vector<ResolverResult>& results);
+}
@@ -0,0 +1,172 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "RttiIndex.h"
+#include "XrefIndex.h"
+#include "Scanner.h"
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace aiModInternal {
+	// The layouts of the x86 RTTI structures. Pointers are image addresses.
+	struct RttiCompleteObjectLocatorData {
+		uint32_t signature;
+		uint32_t offset;
+		uint32_t cdOffset;
+		uint32_t typeDescriptor;
+		uint32_t classHierarchy;
+	};
+	struct RttiClassHierarchyData {
+		uint32_t signature;
+		uint32_t attributes;
+		uint32_t baseClassCount;
+		uint32_t baseClassArray;
+	};
+	static const size_t TYPE_DESCRIPTOR_NAME_OFFSET = 8;
+
+	// Converts `ns::Foo` to the name of a type descriptor for a class or struct, e.g. `.?AVFoo@ns@@`.
+	static string decorateName(const string& name, char kind) {
+		string decorated = str_format(".?A%c", kind);
+		size_t end = name.size();
+		for (;;) {
+			auto separator = name.rfind("::", end - 1);
+			auto start = separator == string::npos ? 0 : separator + 2;
+			decorated += name.substr(start, end - start) + "@";
+			if (separator == string::npos || separator == 0) break;
+			end = separator;
+		}
+		return decorated + "@";
+	}
+
+	RttiIndex::RttiIndex(const PEModule& module, std::shared_ptr<XrefIndex> xrefs) : xrefs(xrefs) {
+		data = module.tryGetSegment(".data");
+		rdata = module.tryGetSegment(".rdata");
+		text = module.tryGetSegment(".text");
+		imageBase = module.imageBase();
+		preferredBase = module.toImageAddress(imageBase);
+	}
+
+	Offset RttiIndex::readPointer(Offset offset) const {
+		uint32_t value;
+		memcpy(&value, offset, 4);
+		return imageBase + (uint32_t) (value - preferredBase);
+	}
+
+	void RttiIndex::build() {
+		std::call_once(built, [this]() { buildImpl(); });
+	}
+	void RttiIndex::buildImpl() {
+		if (!data.has_value() || !rdata.has_value() || !text.has_value()) return;
+		DPRINT_LOW("Building RTTI index...");
+
+		// Type descriptors are a pointer to the type_info vftable, a NULL pointer, and the decorated name.
+		MultiPatternScanner scanner;
+		scanner.addString(".?AV");
+		scanner.addString(".?AU");
+		auto dataEnd = data->base + data->length;
+		for (auto& hits : scanner.scan(*data)) {
+			for (auto name : hits) {
+				if (name < data->base + TYPE_DESCRIPTOR_NAME_OFFSET) continue;
+				uint32_t spare;
+				memcpy(&spare, name - 4, 4);
+				auto nameEnd = (Offset) memchr(name, 0, dataEnd - name);
+				if (spare != 0 || !nameEnd) continue;
+
+				RttiClass rttiClass;
+				rttiClass.name = string((const char*) name, nameEnd - name);
+				rttiClass.typeDescriptor = name - TYPE_DESCRIPTOR_NAME_OFFSET;
+				rttiClass.classHierarchy = NULL;
+				byName[rttiClass.name] = classes.size();
+				byTypeDescriptor[rttiClass.typeDescriptor] = classes.size();
+				classes.push_back(std::move(rttiClass));
+			}
+		}
+		AnalysisStage::addBytesScanned(data->length);
+
+		// Complete object locators refer to their type descriptor, and the slot before each vftable refers to
+		// its complete object locator. A locator is only accepted if its class hierarchy starts with its class.
+		auto rdataEnd = rdata->base + rdata->length;
+		auto isReadable = [&](Offset offset, size_t size) { return offset >= rdata->base && offset + size <= rdataEnd; };
+		std::unordered_set<Offset> vftableMetas;
+		for (auto& rttiClass : classes) {
+			for (auto ref : xrefs->refsTo(rttiClass.typeDescriptor, ".rdata")) {
+				auto locatorOffset = ref - offsetof(RttiCompleteObjectLocatorData, typeDescriptor);
+				if (!isReadable(locatorOffset, sizeof(RttiCompleteObjectLocatorData))) continue;
+				RttiCompleteObjectLocatorData locator;
+				memcpy(&locator, locatorOffset, sizeof(locator));
+				if (locator.signature != 0) continue;
+
+				auto hierarchy = imageBase + (uint32_t) (locator.classHierarchy - preferredBase);
+				if (!isReadable(hierarchy, sizeof(RttiClassHierarchyData))) continue;
+				RttiClassHierarchyData hierarchyData;
+				memcpy(&hierarchyData, hierarchy, sizeof(hierarchyData));
+				auto baseClassArray = imageBase + (uint32_t) (hierarchyData.baseClassArray - preferredBase);
+				if (!hierarchyData.baseClassCount || !isReadable(baseClassArray, 4 * hierarchyData.baseClassCount)) continue;
+				auto firstBase = readPointer(baseClassArray);
+				if (!isReadable(firstBase, 4) || readPointer(firstBase) != rttiClass.typeDescriptor) continue;
+
+				rttiClass.classHierarchy = hierarchy;
+				for (auto meta : xrefs->refsTo(locatorOffset, ".rdata")) {
+					rttiClass.vftables.push_back({ meta + 4, locatorOffset, locator.offset, 0 });
+					vftableMetas.insert(meta);
+				}
+			}
+		}
+
+		size_t vftableCount = 0;
+		for (auto& rttiClass : classes) {
+			// A vftable ends at the first slot that isn't a function, or at the start of the next vftable.
+			for (auto& vftable : rttiClass.vftables) {
+				for (auto slot = vftable.address; isReadable(slot, 4); slot += 4) {
+					if (vftableMetas.find(slot) != vftableMetas.end() || !text->containsOffset(readPointer(slot))) break;
+					vftable.slotCount++;
+				}
+			}
+			std::sort(rttiClass.vftables.begin(), rttiClass.vftables.end(),
+			          [](const RttiVftable& a, const RttiVftable& b) { return a.offset < b.offset; });
+			vftableCount += rttiClass.vftables.size();
+
+			// The first entry in the base class array is the class itself.
+			if (!rttiClass.classHierarchy) continue;
+			RttiClassHierarchyData hierarchyData;
+			memcpy(&hierarchyData, rttiClass.classHierarchy, sizeof(hierarchyData));
+			auto baseClassArray = imageBase + (uint32_t) (hierarchyData.baseClassArray - preferredBase);
+			for (uint32_t i = 1; i < hierarchyData.baseClassCount; i++) {
+				auto baseClass = readPointer(baseClassArray + 4 * i);
+				if (!isReadable(baseClass, 4)) continue;
+				auto find = byTypeDescriptor.find(readPointer(baseClass));
+				if (find != byTypeDescriptor.end()) rttiClass.baseClasses.push_back(classes[find->second].name);
+			}
+		}
+
+		DPRINT_LOW("  Found %d classes and %d vftables.", classes.size(), vftableCount);
+	}
+
+	const RttiClass* RttiIndex::findClass(const char* name) {
+		build();
+		string key = name;
+		auto find = byName.find(key);
+		if (find == byName.end() && key.compare(0, 3, ".?A") != 0) {
+			find = byName.find(decorateName(key, 'V'));
+			if (find == byName.end()) find = byName.find(decorateName(key, 'U'));
+		}
+		if (find == byName.end()) return NULL;
+		return &classes[find->second];
+	}
+	std::optional<Offset> RttiIndex::vftableFor(const char* name) {
+		auto rttiClass = findClass(name);
+		if (!rttiClass || rttiClass->vftables.empty() || rttiClass->vftables[0].offset != 0) return std::nullopt;
+		return rttiClass->vftables[0].address;
+	}
+	std::optional<Offset> RttiIndex::virtualFunction(const char* name, size_t slot) {
+		auto rttiClass = findClass(name);
+		if (!rttiClass || rttiClass->vftables.empty() || rttiClass->vftables[0].offset != 0) return std::nullopt;
+		auto& vftable = rttiClass->vftables[0];
+		if (slot >= vftable.slotCount) return std::nullopt;
+		return readPointer(vftable.address + 4 * slot);
+	}
+}
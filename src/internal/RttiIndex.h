@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace aiModInternal {
+	struct RttiVftable final {
+		Offset address; // The first virtual function slot.
+		Offset completeObjectLocator;
+		uint32_t offset; // The offset of the subobject using this vftable within the complete object.
+		size_t slotCount;
+	};
+	struct RttiClass final {
+		string name; // The decorated name, e.g. `.?AUCVarBase@@`.
+		Offset typeDescriptor;
+		Offset classHierarchy; // NULL for classes without a vftable of their own.
+		std::vector<string> baseClasses; // Decorated names, in the order of the class hierarchy descriptor.
+		std::vector<RttiVftable> vftables; // Sorted by offset, so the primary vftable comes first.
+	};
+
+	// The MSVC RTTI of a module: every type descriptor in .data, and the complete object locators, class
+	// hierarchy descriptors and vftables in .rdata that refer to them. Everything is found the first time
+	// the index is queried, using the data reference tables of the XrefIndex, and looked up by name after.
+	//
+	// Names can be given decorated (`.?AVFoo@ns@@`) or as written in C++ (`ns::Foo`).
+	struct RttiIndex final {
+		RttiIndex(const PEModule& module, std::shared_ptr<XrefIndex> xrefs);
+		RttiIndex(const RttiIndex&) = delete;
+
+		const RttiClass* findClass(const char* name);
+		// The vftable for the complete object, rather than one of its base class subobjects.
+		std::optional<Offset> vftableFor(const char* name);
+		// The function in a slot of a class's primary vftable.
+		std::optional<Offset> virtualFunction(const char* name, size_t slot);
+		inline size_t size() {
+			build();
+			return classes.size();
+		}
+
+	private:
+		std::optional<Segment> data, rdata, text;
+		Offset imageBase;
+		uint32_t preferredBase;
+		std::shared_ptr<XrefIndex> xrefs;
+
+		std::once_flag built;
+		std::vector<RttiClass> classes;
+		std::unordered_map<string, size_t> byName;
+		std::unordered_map<Offset, size_t> byTypeDescriptor;
+
+		Offset readPointer(Offset offset) const;
+		void build();
+		void buildImpl();
+	};
+}
@@ -0,0 +1,368 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "Scanner.h"
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SCANNER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles intrinsics for any instruction set, so the AVX2 kernel only has to be skipped at runtime.
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace aiModInternal {
+#pragma region MultiPatternScanner
+	size_t MultiPatternScanner::addString(string needle) {
+		ASSERT_FATAL(needle.size() > 0);
+		auto id = needleLengths.size();
+		strings.push_back(needle);
+		stringIds.push_back(id);
+		needleLengths.push_back(needle.size());
+		compiled = false;
+		return id;
+	}
+	size_t MultiPatternScanner::addOffset(Offset offset) {
+		auto id = needleLengths.size();
+		auto value = (uint32_t) (size_t) offset;
+		offsets[value].push_back(id);
+		offsetFilter[(value & 0xFFFF) / 64] |= 1ULL << (value & 63);
+		needleLengths.push_back(4);
+		return id;
+	}
+
+	void MultiPatternScanner::compile() {
+		// Build the trie.
+		std::vector<std::vector<size_t>> nodeOutputs(1);
+		transitions.assign(256, -1);
+		for (size_t i = 0; i < strings.size(); i++) {
+			int32_t node = 0;
+			for (auto ch : strings[i]) {
+				auto& next = transitions[node * 256 + (uint8_t) ch];
+				if (next == -1) {
+					next = (int32_t) nodeOutputs.size();
+					nodeOutputs.emplace_back();
+					transitions.resize(transitions.size() + 256, -1);
+				}
+				node = transitions[node * 256 + (uint8_t) ch];
+			}
+			nodeOutputs[node].push_back(stringIds[i]);
+		}
+
+		// Add failure transitions in breadth-first order, turning the trie into a DFA.
+		std::vector<int32_t> fail(nodeOutputs.size(), 0);
+		std::vector<int32_t> queue;
+		for (int ch = 0; ch < 256; ch++) {
+			auto& next = transitions[ch];
+			if (next == -1) next = 0;
+			else queue.push_back(next);
+		}
+		for (size_t i = 0; i < queue.size(); i++) {
+			auto node = queue[i];
+			for (int ch = 0; ch < 256; ch++) {
+				auto& next = transitions[node * 256 + ch];
+				auto fallback = transitions[fail[node] * 256 + ch];
+				if (next == -1) next = fallback;
+				else {
+					fail[next] = fallback;
+					auto& inherited = nodeOutputs[fallback];
+					nodeOutputs[next].insert(nodeOutputs[next].end(), inherited.begin(), inherited.end());
+					queue.push_back(next);
+				}
+			}
+		}
+
+		// Flatten the outputs of each node so the scan loop only needs to compare two indexes.
+		outputStart.clear();
+		outputs.clear();
+		for (auto& list : nodeOutputs) {
+			outputStart.push_back((uint32_t) outputs.size());
+			outputs.insert(outputs.end(), list.begin(), list.end());
+		}
+		outputStart.push_back((uint32_t) outputs.size());
+		compiled = true;
+	}
+
+	std::vector<std::vector<Offset>> MultiPatternScanner::scan(const Segment& segment) {
+		std::vector<std::vector<Offset>> results(needleLengths.size());
+		scanWith(segment, [&](size_t id, Offset offset) {
+			results[id].push_back(offset);
+			return true;
+		});
+		return results;
+	}
+#pragma endregion
+
+#pragma region MaskedPatternScanner
+#ifdef SCANNER_X86
+	static uint32_t countTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, value);
+		return index;
+#else
+		return __builtin_ctz(value);
+#endif
+	}
+	static bool detectKernel(ScanKernel kernel) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		auto maxLeaf = info[0];
+		__cpuid(info, 1);
+		auto sse2 = (info[3] & (1 << 26)) != 0;
+		// AVX registers also need to be saved by the operating system.
+		auto avxEnabled = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		auto avx2 = false;
+		if (maxLeaf >= 7 && avxEnabled) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		return kernel == ScanKernel::Sse2 ? sse2 : avx2;
+#else
+		__builtin_cpu_init();
+		return kernel == ScanKernel::Sse2 ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+	static size_t findCandidatesScalar(const uint8_t* data, size_t start, size_t count, size_t, uint8_t first,
+	                                   uint8_t second, size_t secondDelta, uint32_t* out) {
+		size_t found = 0;
+		for (auto i = start; i < count; i++) {
+			if (data[i] == first && data[i + secondDelta] == second) out[found++] = (uint32_t) i;
+		}
+		return found;
+	}
+#ifdef SCANNER_X86
+	static size_t findCandidatesSse2(const uint8_t* data, size_t start, size_t count, size_t readable,
+	                                 uint8_t first, uint8_t second, size_t secondDelta, uint32_t* out) {
+		auto firstVector = _mm_set1_epi8((char) first), secondVector = _mm_set1_epi8((char) second);
+		size_t found = 0, i = start;
+		for (; i + 16 <= count && i + secondDelta + 16 <= readable; i += 16) {
+			auto firstMatches = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i)), firstVector);
+			auto secondMatches = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + secondDelta)), secondVector);
+			auto mask = (uint32_t) _mm_movemask_epi8(_mm_and_si128(firstMatches, secondMatches));
+			for (; mask; mask &= mask - 1) out[found++] = (uint32_t) (i + countTrailingZeros(mask));
+		}
+		return found + findCandidatesScalar(data, i, count, readable, first, second, secondDelta, out + found);
+	}
+	TARGET_AVX2 static size_t findCandidatesAvx2(const uint8_t* data, size_t start, size_t count, size_t readable,
+	                                             uint8_t first, uint8_t second, size_t secondDelta, uint32_t* out) {
+		auto firstVector = _mm256_set1_epi8((char) first), secondVector = _mm256_set1_epi8((char) second);
+		size_t found = 0, i = start;
+		for (; i + 32 <= count && i + secondDelta + 32 <= readable; i += 32) {
+			auto firstMatches = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i)), firstVector);
+			auto secondMatches = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + secondDelta)),
+			                                       secondVector);
+			auto mask = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(firstMatches, secondMatches));
+			for (; mask; mask &= mask - 1) out[found++] = (uint32_t) (i + countTrailingZeros(mask));
+		}
+		// The upper halves of the AVX registers are cleared before the SSE2 kernel runs on the rest.
+		_mm256_zeroupper();
+		return found + findCandidatesSse2(data, i, count, readable, first, second, secondDelta, out + found);
+	}
+#endif
+
+	const char* scanKernelName(ScanKernel kernel) {
+		switch (kernel) {
+			case ScanKernel::Sse2: return "SSE2";
+			case ScanKernel::Avx2: return "AVX2";
+			default: return "scalar";
+		}
+	}
+	bool isScanKernelSupported(ScanKernel kernel) {
+		if (kernel == ScanKernel::Scalar) return true;
+#ifdef SCANNER_X86
+		static const bool sse2 = detectKernel(ScanKernel::Sse2), avx2 = detectKernel(ScanKernel::Avx2);
+		return kernel == ScanKernel::Sse2 ? sse2 : avx2;
+#else
+		return false;
+#endif
+	}
+	ScanKernel getBestScanKernel() {
+		static const ScanKernel best = []() {
+			auto kernel = isScanKernelSupported(ScanKernel::Avx2) ? ScanKernel::Avx2
+			            : isScanKernelSupported(ScanKernel::Sse2) ? ScanKernel::Sse2 : ScanKernel::Scalar;
+			DPRINT_LOW("Using the %s pattern scan kernel.", scanKernelName(kernel));
+			return kernel;
+		}();
+		return best;
+	}
+
+	MaskedPatternScanner::MaskedPatternScanner(ScanKernel kernel) {
+		if (!isScanKernelSupported(kernel)) kernel = getBestScanKernel();
+		switch (kernel) {
+#ifdef SCANNER_X86
+			case ScanKernel::Avx2: findCandidates = findCandidatesAvx2; break;
+			case ScanKernel::Sse2: findCandidates = findCandidatesSse2; break;
+#endif
+			default: findCandidates = findCandidatesScalar; break;
+		}
+	}
+
+	// Bytes that are common in x86 code, which make poor anchors since they match almost everywhere.
+	static int anchorCost(uint8_t byte) {
+		switch (byte) {
+			case 0x00: case 0xFF: case 0xCC: return 3;
+			case 0x8B: case 0x89: case 0x8D: case 0xE8: case 0x45: case 0x4D: case 0x55: return 2;
+			case 0x0F: case 0x83: case 0x85: case 0x75: case 0x74: case 0x24: case 0x50: return 1;
+			default: return 0;
+		}
+	}
+	size_t MaskedPatternScanner::addPattern(const BytePattern& pattern) {
+		ASSERT_FATAL(pattern.size() > 0 && pattern.size() == pattern.mask.size());
+		// Anchor on the two rarest bytes that have to match, in the order they appear.
+		std::vector<size_t> fixed;
+		for (size_t i = 0; i < pattern.size(); i++) if (pattern.mask[i] == 0xFF) fixed.push_back(i);
+		ASSERT_FATAL(!fixed.empty());
+		std::stable_sort(fixed.begin(), fixed.end(), [&](size_t a, size_t b) {
+			return anchorCost(pattern.bytes[a]) < anchorCost(pattern.bytes[b]);
+		});
+		auto firstAnchor = fixed[0], secondAnchor = fixed.size() > 1 ? fixed[1] : fixed[0];
+		if (secondAnchor < firstAnchor) std::swap(firstAnchor, secondAnchor);
+
+		patterns.push_back({ pattern, firstAnchor, secondAnchor - firstAnchor, pattern.bytes[firstAnchor],
+		                     pattern.bytes[secondAnchor] });
+		return patterns.size() - 1;
+	}
+
+	std::vector<std::vector<Offset>> MaskedPatternScanner::scan(const Segment& segment) {
+		std::vector<std::vector<Offset>> results(patterns.size());
+		scanWith(segment, [&](size_t id, Offset offset) {
+			results[id].push_back(offset);
+			return true;
+		});
+		return results;
+	}
+#pragma endregion
+
+#pragma region ScanBatch
+	ScanBatch::ScanBatch(Segment segment, std::vector<string> strings) : segment(segment) {
+		for (auto& str : strings) pendingStrings[str] = SIZE_MAX;
+	}
+
+	template <typename Key> void ScanBatch::add(std::unordered_map<Key, Matches>& results,
+	                                            std::unordered_map<Key, size_t>& pending, const Key& key, size_t limit) {
+		ASSERT_FATAL(limit > 0);
+		auto find = results.find(key);
+		if (find != results.end() && find->second.covers(limit)) return;
+		auto& pendingLimit = pending[key];
+		pendingLimit = std::max(pendingLimit, limit);
+	}
+	void ScanBatch::addString(string str, size_t limit) {
+		std::lock_guard<std::mutex> guard(lock);
+		add(stringResults, pendingStrings, str, limit);
+	}
+	void ScanBatch::addOffset(Offset offset, size_t limit) {
+		std::lock_guard<std::mutex> guard(lock);
+		add(offsetResults, pendingOffsets, offset, limit);
+	}
+	void ScanBatch::addPattern(string pattern, size_t limit) {
+		std::lock_guard<std::mutex> guard(lock);
+		add(patternResults, pendingPatterns, pattern, limit);
+	}
+
+	// Keeps the first matches of each needle up to its limit, and stops scanning once every needle has reached
+	// it. Returns the number of bytes scanned.
+	template <typename Scanner> static size_t scanLimited(Scanner& scanner, const Segment& segment,
+	                                                      const std::vector<size_t>& limits,
+	                                                      std::vector<std::vector<Offset>>& results) {
+		results.assign(limits.size(), {});
+		auto open = limits.size();
+		size_t scanned = segment.length;
+		scanner.scanWith(segment, [&](size_t id, Offset offset) {
+			auto& matches = results[id];
+			if (matches.size() == limits[id]) return true;
+			matches.push_back(offset);
+			if (matches.size() == limits[id] && --open == 0) {
+				scanned = offset - segment.base;
+				return false;
+			}
+			return true;
+		});
+		return scanned;
+	}
+
+	void ScanBatch::runPending() {
+		MultiPatternScanner scanner;
+		std::vector<size_t> limits;
+		std::vector<std::pair<string, size_t>> stringIds;
+		std::vector<std::pair<Offset, size_t>> offsetIds;
+		for (auto& pair : pendingStrings) {
+			stringIds.push_back({ pair.first, scanner.addString(pair.first) });
+			limits.push_back(pair.second);
+		}
+		for (auto& pair : pendingOffsets) {
+			offsetIds.push_back({ pair.first, scanner.addOffset(pair.first) });
+			limits.push_back(pair.second);
+		}
+		pendingStrings.clear();
+		pendingOffsets.clear();
+		if (scanner.needleCount() != 0) {
+			DPRINT_LOW("  Scanning segment %s for %d needles.", segment.name.c_str(), scanner.needleCount());
+			std::vector<std::vector<Offset>> results;
+			AnalysisStage::addBytesScanned(scanLimited(scanner, segment, limits, results));
+			for (auto& pair : stringIds) stringResults[pair.first] = { std::move(results[pair.second]), limits[pair.second] };
+			for (auto& pair : offsetIds) offsetResults[pair.first] = { std::move(results[pair.second]), limits[pair.second] };
+		}
+
+		MaskedPatternScanner patternScanner;
+		std::vector<size_t> patternLimits;
+		std::vector<std::pair<string, size_t>> patternIds;
+		for (auto& pair : pendingPatterns) {
+			patternIds.push_back({ pair.first, patternScanner.addPattern(BytePattern::parse(pair.first.c_str())) });
+			patternLimits.push_back(pair.second);
+		}
+		pendingPatterns.clear();
+		if (patternScanner.patternCount() == 0) return;
+
+		DPRINT_LOW("  Scanning segment %s for %d patterns.", segment.name.c_str(), patternScanner.patternCount());
+		std::vector<std::vector<Offset>> results;
+		AnalysisStage::addBytesScanned(scanLimited(patternScanner, segment, patternLimits, results));
+		for (auto& pair : patternIds) patternResults[pair.first] = { std::move(results[pair.second]), patternLimits[pair.second] };
+	}
+
+	template <typename Key> std::vector<Offset> ScanBatch::find(std::unordered_map<Key, Matches>& results,
+	                                                            std::unordered_map<Key, size_t>& pending,
+	                                                            const Key& key, size_t limit) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto find = results.find(key);
+		if (find == results.end() || !find->second.covers(limit)) {
+			add(results, pending, key, limit);
+			runPending();
+			find = results.find(key);
+		}
+		auto& offsets = find->second.offsets;
+		return std::vector<Offset>(offsets.begin(), offsets.begin() + std::min(limit, offsets.size()));
+	}
+
+	std::vector<Offset> ScanBatch::findString(string str, size_t limit) {
+		return find(stringResults, pendingStrings, str, limit);
+	}
+	std::optional<Offset> ScanBatch::findOnlyString(string str) {
+		return ifOnly(findString(str, 2));
+	}
+
+	std::vector<Offset> ScanBatch::findOffset(Offset offset, size_t limit) {
+		return find(offsetResults, pendingOffsets, offset, limit);
+	}
+	std::optional<Offset> ScanBatch::findOnlyOffset(Offset offset) {
+		return ifOnly(findOffset(offset, 2));
+	}
+
+	std::vector<Offset> ScanBatch::findPattern(string pattern, size_t limit) {
+		return find(patternResults, pendingPatterns, pattern, limit);
+	}
+	std::optional<Offset> ScanBatch::findOnlyPattern(string pattern) {
+		return ifOnly(findPattern(pattern, 2));
+	}
+#pragma endregion
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace aiModInternal {
+	// Finds every occurrence of a set of needles with a single linear pass over a segment. Strings are matched
+	// with an Aho-Corasick automaton, and 4-byte offsets are looked up in a hash table at every position, using
+	// a bitmap over the low 16 bits of the window to skip most lookups.
+	struct MultiPatternScanner final {
+		size_t addString(string needle);
+		size_t addOffset(Offset offset);
+		inline size_t needleCount() const {
+			return needleLengths.size();
+		}
+
+		std::vector<std::vector<Offset>> scan(const Segment& segment);
+		// Calls visit(id, offset) for each match, in the order the matches end, and stops scanning the segment
+		// as soon as it returns false. Nothing is allocated for the matches.
+		template <typename Visitor> void scanWith(const Segment& segment, Visitor visit);
+
+	private:
+		std::vector<string> strings;
+		std::vector<size_t> stringIds;
+		std::vector<size_t> needleLengths;
+		std::unordered_map<uint32_t, std::vector<size_t>> offsets;
+		uint64_t offsetFilter[0x10000 / 64] = { 0 };
+
+		// Compiled automaton, rebuilt whenever a string is added.
+		bool compiled = false;
+		std::vector<int32_t> transitions;
+		std::vector<uint32_t> outputStart;
+		std::vector<size_t> outputs;
+
+		void compile();
+	};
+
+	template <typename Visitor> void MultiPatternScanner::scanWith(const Segment& segment, Visitor visit) {
+		if (!compiled) compile();
+
+		auto data = segment.base;
+		auto length = segment.length;
+		auto hasStrings = !strings.empty(), hasOffsets = !offsets.empty();
+
+		int32_t state = 0;
+		uint32_t window = 0;
+		for (size_t i = 0; i < length; i++) {
+			auto byte = data[i];
+			if (hasStrings) {
+				state = transitions[state * 256 + byte];
+				for (auto j = outputStart[state]; j != outputStart[state + 1]; j++) {
+					auto id = outputs[j];
+					if (!visit(id, data + i + 1 - needleLengths[id])) return;
+				}
+			}
+			window = (window >> 8) | ((uint32_t) byte << 24);
+			if (hasOffsets && i >= 3 && (offsetFilter[(window & 0xFFFF) / 64] & (1ULL << (window & 63)))) {
+				auto find = offsets.find(window);
+				if (find != offsets.end()) for (auto id : find->second) if (!visit(id, data + i - 3)) return;
+			}
+		}
+	}
+
+	// The instruction sets a MaskedPatternScanner can search with. Each kernel finds the positions where two
+	// bytes of a pattern match, 1, 16 or 32 positions at a time, and the rest of the pattern is only compared at
+	// those positions.
+	enum class ScanKernel : uint8_t {
+		Scalar, Sse2, Avx2,
+	};
+	const char* scanKernelName(ScanKernel kernel);
+	// Whether a kernel can run on this processor and operating system.
+	bool isScanKernelSupported(ScanKernel kernel);
+	// The fastest supported kernel, detected on first use.
+	ScanKernel getBestScanKernel();
+
+	// Finds every occurrence of a set of byte patterns with wildcards. The segment is searched in chunks small
+	// enough to stay in the cache, and every pattern is searched for in a chunk before moving on to the next one,
+	// so many patterns cost a single pass over memory.
+	struct MaskedPatternScanner final {
+		static const size_t kChunkSize = 16 * 1024;
+
+		// A kernel that isn't supported is replaced by the best one that is.
+		MaskedPatternScanner(ScanKernel kernel = getBestScanKernel());
+
+		size_t addPattern(const BytePattern& pattern);
+		inline size_t patternCount() const {
+			return patterns.size();
+		}
+
+		std::vector<std::vector<Offset>> scan(const Segment& segment);
+		// Calls visit(id, offset) for each match, and stops scanning the segment as soon as it returns false.
+		// The matches of each pattern are visited in order, but matches of different patterns are only ordered
+		// by chunk.
+		template <typename Visitor> void scanWith(const Segment& segment, Visitor visit);
+
+	private:
+		// Finds the positions start <= i < count where data[i] == first and data[i + secondDelta] == second.
+		// Only the first readable bytes of data are read.
+		typedef size_t (*FindCandidates)(const uint8_t* data, size_t start, size_t count, size_t readable,
+		                                 uint8_t first, uint8_t second, size_t secondDelta, uint32_t* out);
+		struct CompiledPattern {
+			BytePattern pattern;
+			size_t firstAnchor;
+			size_t secondDelta; // From the first anchor to the second, which may be the same byte.
+			uint8_t first;
+			uint8_t second;
+		};
+
+		FindCandidates findCandidates;
+		std::vector<CompiledPattern> patterns;
+		std::vector<uint32_t> candidates;
+	};
+
+	template <typename Visitor> void MaskedPatternScanner::scanWith(const Segment& segment, Visitor visit) {
+		auto data = segment.base;
+		auto length = segment.length;
+		candidates.resize(kChunkSize);
+
+		for (size_t chunk = 0; chunk < length; chunk += kChunkSize) {
+			for (size_t id = 0; id < patterns.size(); id++) {
+				auto& compiled = patterns[id];
+				auto size = compiled.pattern.size();
+				if (size > length || chunk > length - size) continue;
+				auto count = std::min(kChunkSize, length - size + 1 - chunk);
+				auto anchor = chunk + compiled.firstAnchor;
+				auto found = findCandidates(data + anchor, 0, count, length - anchor, compiled.first, compiled.second,
+				                            compiled.secondDelta, candidates.data());
+				for (size_t i = 0; i < found; i++) {
+					auto start = data + chunk + candidates[i];
+					if (compiled.pattern.matches(start) && !visit(id, start)) return;
+				}
+			}
+		}
+	}
+
+	// Collects needles from several analysis routines, so a segment only needs to be scanned once for all of
+	// them. Needles that were not registered in advance are scanned for when they are first requested.
+	//
+	// Each needle is registered with the number of matches wanted from it, and only its first matches up to that
+	// limit are kept. The shared pass stops as soon as every needle in it has all the matches it wants, so a batch
+	// of needles that are each expected once, e.g. for Signature::only, stops at their second occurrences instead
+	// of scanning the rest of the segment. A needle registered more than once keeps the largest limit.
+	struct ScanBatch final {
+		ScanBatch(Segment segment, std::vector<string> strings = {});
+		ScanBatch(const ScanBatch&) = delete;
+
+		void addString(string str, size_t limit = SIZE_MAX);
+		void addOffset(Offset offset, size_t limit = SIZE_MAX);
+		// Patterns are given as text, as in BytePattern::parse.
+		void addPattern(string pattern, size_t limit = SIZE_MAX);
+
+		// The first limit occurrences of a needle, in order. A needle that was scanned for with a smaller limit,
+		// and reached it, is scanned for again.
+		std::vector<Offset> findString(string str, size_t limit = SIZE_MAX);
+		std::optional<Offset> findOnlyString(string str);
+
+		std::vector<Offset> findOffset(Offset offset, size_t limit = SIZE_MAX);
+		std::optional<Offset> findOnlyOffset(Offset offset);
+
+		std::vector<Offset> findPattern(string pattern, size_t limit = SIZE_MAX);
+		std::optional<Offset> findOnlyPattern(string pattern);
+
+	private:
+		// The first matches of a needle, from a scan that kept at most limit of them.
+		struct Matches {
+			std::vector<Offset> offsets;
+			size_t limit = 0;
+
+			// Whether these are the first wanted matches, or all of them if there are fewer.
+			inline bool covers(size_t wanted) const {
+				return wanted <= limit || offsets.size() < limit;
+			}
+		};
+
+		Segment segment;
+		std::mutex lock;
+		// The limit each needle is scanned for with.
+		std::unordered_map<string, size_t> pendingStrings;
+		std::unordered_map<Offset, size_t> pendingOffsets;
+		std::unordered_map<string, size_t> pendingPatterns;
+		std::unordered_map<string, Matches> stringResults;
+		std::unordered_map<Offset, Matches> offsetResults;
+		std::unordered_map<string, Matches> patternResults;
+
+		template <typename Key> void add(std::unordered_map<Key, Matches>& results,
+		                                 std::unordered_map<Key, size_t>& pending, const Key& key, size_t limit);
+		template <typename Key> std::vector<Offset> find(std::unordered_map<Key, Matches>& results,
+		                                                 std::unordered_map<Key, size_t>& pending, const Key& key,
+		                                                 size_t limit);
+		void runPending();
+	};
+}
@@ -0,0 +1,505 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "Signature.h"
+#include "XrefIndex.h"
+#include "FunctionMap.h"
+#include "RttiIndex.h"
+#include "DataFlow.h"
+#include "DisassemblyLog.h"
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace aiModInternal {
+	static const char* stepName(SignatureStep step) {
+		switch (step) {
+			case SignatureStep::String: return "String";
+			case SignatureStep::Pattern: return "Pattern";
+			case SignatureStep::Export: return "Export";
+			case SignatureStep::Offset: return "Offset";
+			case SignatureStep::Only: return "Only";
+			case SignatureStep::First: return "First";
+			case SignatureStep::RefsIn: return "RefsIn";
+			case SignatureStep::Entries: return "Entries";
+			case SignatureStep::Calls: return "Calls";
+			case SignatureStep::CallAt: return "CallAt";
+			case SignatureStep::CallsMatching: return "CallsMatching";
+			case SignatureStep::FirstCallTo: return "FirstCallTo";
+			case SignatureStep::CalledFrom: return "CalledFrom";
+			case SignatureStep::Intersect: return "Intersect";
+			case SignatureStep::MatchInstruction: return "MatchInstruction";
+			case SignatureStep::Vftable: return "Vftable";
+			case SignatureStep::PassedTo: return "PassedTo";
+			default: return "UNKNOWN";
+		}
+	}
+
+#pragma region Signature
+	Signature Signature::fromString(string str, const char* segment) {
+		Node node;
+		node.step = SignatureStep::String;
+		node.str = str;
+		node.name = segment;
+		return Signature(std::make_shared<const Node>(node));
+	}
+	Signature Signature::fromPattern(const char* pattern, const char* segment) {
+		// Patterns are checked when the signature is built, rather than when it's first evaluated.
+		BytePattern::parse(pattern);
+		Node node;
+		node.step = SignatureStep::Pattern;
+		node.str = pattern;
+		node.name = segment;
+		return Signature(std::make_shared<const Node>(node));
+	}
+	Signature Signature::fromExport(const char* name) {
+		Node node;
+		node.step = SignatureStep::Export;
+		node.name = name;
+		return Signature(std::make_shared<const Node>(node));
+	}
+	Signature Signature::fromVftable(const char* className) {
+		Node node;
+		node.step = SignatureStep::Vftable;
+		node.name = className;
+		return Signature(std::make_shared<const Node>(node));
+	}
+
+	Signature Signature::then(Node next) const {
+		ASSERT_FATAL(node);
+		next.parent = node;
+		return Signature(std::make_shared<const Node>(next));
+	}
+
+	Signature Signature::offset(ptrdiff_t delta) const {
+		Node next;
+		next.step = SignatureStep::Offset;
+		next.delta = delta;
+		return then(next);
+	}
+	Signature Signature::only() const {
+		Node next;
+		next.step = SignatureStep::Only;
+		return then(next);
+	}
+	Signature Signature::first() const {
+		Node next;
+		next.step = SignatureStep::First;
+		return then(next);
+	}
+	Signature Signature::refsIn(const char* segment, bool unique) const {
+		Node next;
+		next.step = SignatureStep::RefsIn;
+		next.name = segment;
+		next.unique = unique;
+		return then(next);
+	}
+	Signature Signature::entries(size_t maxInstructions) const {
+		Node next;
+		next.step = SignatureStep::Entries;
+		next.count = maxInstructions;
+		return then(next);
+	}
+	Signature Signature::calls() const {
+		Node next;
+		next.step = SignatureStep::Calls;
+		return then(next);
+	}
+	Signature Signature::callAt(size_t index, size_t expectedCount) const {
+		Node next;
+		next.step = SignatureStep::CallAt;
+		next.delta = (ptrdiff_t) index;
+		next.count = expectedCount;
+		return then(next);
+	}
+	Signature Signature::callsMatching(const Signature& target, ptrdiff_t relative, size_t minIndex) const {
+		Node next;
+		next.step = SignatureStep::CallsMatching;
+		next.other = target.node;
+		next.delta = relative;
+		next.count = minIndex;
+		return then(next);
+	}
+	Signature Signature::firstCallTo(const Signature& target) const {
+		Node next;
+		next.step = SignatureStep::FirstCallTo;
+		next.other = target.node;
+		return then(next);
+	}
+	Signature Signature::calledFrom(const Signature& caller) const {
+		Node next;
+		next.step = SignatureStep::CalledFrom;
+		next.other = caller.node;
+		return then(next);
+	}
+	Signature Signature::intersect(const Signature& other) const {
+		Node next;
+		next.step = SignatureStep::Intersect;
+		next.other = other.node;
+		return then(next);
+	}
+	Signature Signature::passedTo(const Signature& target, int argument) const {
+		ASSERT_FATAL(argument >= kThisArgument && argument < (int) CallSite::kMaxArguments);
+		Node next;
+		next.step = SignatureStep::PassedTo;
+		next.other = target.node;
+		next.delta = argument;
+		return then(next);
+	}
+	Signature Signature::matchInstruction(InstructionMatcher matcher, const char* criteria) const {
+		Node next;
+		next.step = SignatureStep::MatchInstruction;
+		next.matcher = matcher;
+		next.name = criteria;
+		return then(next);
+	}
+#pragma endregion
+
+#pragma region SignatureEngine
+	SignatureEngine::SignatureEngine(const PEModule& module, const std::vector<Signature>& signatures) : module(module) {
+		for (auto& signature : signatures) addNeedles(signature.get().get());
+	}
+
+	ScanBatch& SignatureEngine::getScan(const char* segment) {
+		auto& scan = scans[segment];
+		if (!scan) scan = std::make_unique<ScanBatch>(module.getSegment(segment));
+		return *scan;
+	}
+	// The number of offsets a step needs from the step before it. Only needs two to tell that there is more
+	// than one.
+	static size_t inputLimit(SignatureStep step) {
+		switch (step) {
+			case SignatureStep::Only: return 2;
+			case SignatureStep::First: return 1;
+			default: return SIZE_MAX;
+		}
+	}
+	static bool isNeedle(SignatureStep step) {
+		return step == SignatureStep::String || step == SignatureStep::Pattern;
+	}
+	void SignatureEngine::addNeedles(const Signature::Node* node) {
+		// The last step of a signature needs every offset.
+		size_t limit = SIZE_MAX;
+		for (; node; node = node->parent.get()) {
+			if (node->step == SignatureStep::String) getScan(node->name).addString(node->str, limit);
+			if (node->step == SignatureStep::Pattern) getScan(node->name).addPattern(node->str, limit);
+			if (node->other) addNeedles(node->other.get());
+			limit = inputLimit(node->step);
+		}
+	}
+	std::vector<Offset> SignatureEngine::findNeedle(const Signature::Node* node, size_t limit) {
+		auto& scan = getScan(node->name);
+		return node->step == SignatureStep::String ? scan.findString(node->str, limit) : scan.findPattern(node->str, limit);
+	}
+
+	void SignatureEngine::parseFunctions(const std::vector<Offset>& offsets) {
+		std::vector<Offset> missing;
+		for (auto offset : offsets)
+			if (functions.find(offset) == functions.end() &&
+			    std::find(missing.begin(), missing.end(), offset) == missing.end()) missing.push_back(offset);
+		auto parsed = module.parseFunctionsByOffset(missing);
+		for (size_t i = 0; i < missing.size(); i++) {
+			if (parsed[i].has_value())
+				for (auto length : parsed[i]->lengths) AnalysisStage::addBytesScanned(length);
+			functions.emplace(missing[i], std::move(parsed[i]));
+		}
+	}
+	const ParsedFunction* SignatureEngine::getFunction(Offset offset) {
+		auto find = functions.find(offset);
+		if (find == functions.end()) {
+			parseFunctions({ offset });
+			find = functions.find(offset);
+		}
+		return find->second.has_value() ? &*find->second : NULL;
+	}
+
+	std::vector<Offset> SignatureEngine::evaluateStep(const Signature::Node* node, const std::vector<Offset>& input,
+	                                                  AnalysisStage& stage) {
+		auto& xrefs = module.xrefs();
+		std::vector<Offset> output;
+		switch (node->step) {
+			case SignatureStep::String:
+			case SignatureStep::Pattern:
+				output = findNeedle(node, SIZE_MAX);
+				break;
+			case SignatureStep::Export: {
+				auto offset = module.getFunctionByName(node->name);
+				if (offset.has_value()) output.push_back(*offset);
+				break;
+			}
+			case SignatureStep::Vftable: {
+				auto offset = module.rtti().vftableFor(node->name);
+				if (offset.has_value()) output.push_back(*offset);
+				break;
+			}
+			case SignatureStep::Offset:
+				for (auto offset : input) {
+					output.push_back(offset + node->delta);
+					auto origin = origins.find(offset);
+					if (origin != origins.end()) origins.emplace(offset + node->delta, origin->second);
+				}
+				break;
+			case SignatureStep::Only:
+				if (input.size() == 1) output = input;
+				else {
+					DPRINT_LOW("    Expected exactly one offset, found %s%d.", input.size() > 1 ? "at least " : "", input.size());
+					stage.rejected(input.size());
+				}
+				break;
+			case SignatureStep::First:
+				if (!input.empty()) output.push_back(input[0]);
+				stage.rejected(input.size() - output.size());
+				break;
+			case SignatureStep::RefsIn:
+				for (auto offset : input) {
+					auto refs = xrefs.refsTo(offset, node->name);
+					if (node->unique && refs.size() != 1) {
+						stage.rejected(refs.size());
+						continue;
+					}
+					output.insert(output.end(), refs.begin(), refs.end());
+				}
+				break;
+			case SignatureStep::Entries: {
+				auto& functionMap = module.functions();
+				std::vector<Offset> entries;
+				std::unordered_set<Offset> seen;
+				for (auto offset : input)
+					for (auto entry : functionMap.findPotentialEntries(offset, node->count))
+						if (seen.insert(entry).second) entries.push_back(entry);
+
+				// The entries of each offset are closest first, so an earlier entry whose code runs into a closer
+				// one, such as a second entry of the same function, is dropped instead of being searched again.
+				auto parsed = module.parseFunctionsByOffset(entries, 10000, true);
+				for (size_t i = 0; i < entries.size(); i++) {
+					if (!parsed[i].has_value()) {
+						stage.rejected(1);
+						continue;
+					}
+					for (auto length : parsed[i]->lengths) AnalysisStage::addBytesScanned(length);
+					output.push_back(entries[i]);
+					functions.emplace(entries[i], std::move(parsed[i]));
+				}
+				break;
+			}
+			case SignatureStep::Calls:
+			case SignatureStep::CallAt:
+			case SignatureStep::CallsMatching:
+			case SignatureStep::FirstCallTo: {
+				parseFunctions(input);
+				const std::vector<Offset>* targetList = NULL;
+				std::unordered_set<Offset> targets;
+				if (node->other) {
+					targetList = &evaluateNode(node->other);
+					targets.insert(targetList->begin(), targetList->end());
+				}
+				for (auto offset : input) {
+					auto function = getFunction(offset);
+					if (!function) {
+						stage.rejected(1);
+						continue;
+					}
+					auto calls = function->getCallOffsets(offset);
+					auto sites = function->getCallSites(offset);
+					for (size_t i = 0; i < calls.size(); i++) origins.emplace(calls[i], Origin{ sites[i], calls[i] });
+					if (node->step == SignatureStep::Calls) {
+						output.insert(output.end(), calls.begin(), calls.end());
+					} else if (node->step == SignatureStep::CallAt) {
+						if (node->count && calls.size() != node->count) {
+							DPRINT_LOW("    Wrong number of calls in function at 0x%p. (expected %d, found %d)",
+							           offset, node->count, calls.size());
+							stage.rejected(1);
+							continue;
+						}
+						if ((size_t) node->delta < calls.size()) output.push_back(calls[node->delta]);
+						else stage.rejected(1);
+					} else if (node->step == SignatureStep::FirstCallTo) {
+						if (!calls.empty() && targets.find(calls[0]) != targets.end()) output.push_back(offset);
+						else stage.rejected(1);
+					} else {
+						std::unordered_map<Offset, size_t> firstCalls;
+						for (size_t i = 0; i < calls.size(); i++) firstCalls.emplace(calls[i], i);
+						auto matched = false;
+						for (auto target : *targetList) {
+							auto find = firstCalls.find(target);
+							if (find == firstCalls.end() || find->second < node->count) continue;
+							auto index = (ptrdiff_t) find->second + node->delta;
+							if (index < 0 || index >= (ptrdiff_t) calls.size()) continue;
+							output.push_back(calls[index]);
+							matched = true;
+							break;
+						}
+						if (!matched) stage.rejected(1);
+					}
+				}
+				break;
+			}
+			case SignatureStep::CalledFrom: {
+				auto& callers = evaluateNode(node->other);
+				parseFunctions(callers);
+				for (auto offset : input) {
+					auto called = false;
+					// The xref index finds call sites by scanning for E8 bytes, which may be inside another
+					// instruction, so a site only counts if the caller decoded a call to the offset there.
+					for (auto site : xrefs.callersOf(offset)) {
+						for (auto caller : callers) {
+							auto function = getFunction(caller);
+							if (function && function->isCallTo(site, offset)) called = true;
+						}
+					}
+					if (called) output.push_back(offset);
+					else stage.rejected(1);
+				}
+				break;
+			}
+			case SignatureStep::Intersect: {
+				auto& otherList = evaluateNode(node->other);
+				std::unordered_set<Offset> other(otherList.begin(), otherList.end());
+				for (auto offset : input) {
+					if (other.find(offset) != other.end()) output.push_back(offset);
+					else stage.rejected(1);
+				}
+				break;
+			}
+			case SignatureStep::MatchInstruction:
+				parseFunctions(input);
+				for (auto offset : input) {
+					auto function = getFunction(offset);
+					if (!function) {
+						stage.rejected(1);
+						continue;
+					}
+					auto matches = function->findInstructions<Origin>([&](const DecodedInstruction& instr) -> std::optional<Origin> {
+						auto match = node->matcher(instr);
+						if (!match.has_value()) return std::nullopt;
+						return Origin{ instr.instrAddress, module.fromImageAddress((uint32_t) (size_t) *match) };
+					}, node->name);
+					for (auto& match : matches) {
+						output.push_back(match.address);
+						origins.emplace(match.address, match);
+					}
+				}
+				break;
+			case SignatureStep::PassedTo: {
+				auto& targetList = evaluateNode(node->other);
+				std::unordered_set<Offset> targets(targetList.begin(), targetList.end());
+				parseFunctions(input);
+				for (auto offset : input) {
+					auto function = getFunction(offset);
+					if (!function) {
+						stage.rejected(1);
+						continue;
+					}
+					for (auto& site : findCallSites(*function, offset)) {
+						if (targets.find(site.target) == targets.end()) continue;
+						auto argument = node->delta == Signature::kThisArgument ? site.thisValue :
+						                (size_t) node->delta < site.argumentCount ? site.arguments[node->delta] : TrackedValue();
+						if (argument.source == ValueSource::CallResult) {
+							output.push_back(argument.callTarget);
+							origins.emplace(argument.callTarget, Origin{ argument.callAddress, argument.callTarget });
+							continue;
+						}
+						auto address = module.fromImageAddress(argument.value);
+						if (argument.source != ValueSource::Unknown && module.segmentForOffset(address).has_value())
+							output.push_back(address);
+						else stage.rejected(1);
+					}
+				}
+				break;
+			}
+		}
+		return output;
+	}
+
+	const std::vector<Offset>& SignatureEngine::evaluateNode(const std::shared_ptr<const Signature::Node>& node) {
+		auto find = results.find(node.get());
+		if (find != results.end()) return find->second.second;
+
+		// A step that only needs the first few offsets of a needle takes them straight from the scan, which stops
+		// once it has found them, unless the needle's full list has already been found for another step.
+		std::vector<Offset> input;
+		auto parent = node->parent.get();
+		auto limit = inputLimit(node->step);
+		if (parent && isNeedle(parent->step) && limit != SIZE_MAX && results.find(parent) == results.end())
+			input = findNeedle(parent, limit);
+		else if (parent) input = evaluateNode(node->parent);
+
+		AnalysisStage stage(stepName(node->step));
+		auto output = evaluateStep(node.get(), input, stage);
+
+		// Remove duplicates, keeping the first occurrence of each offset.
+		std::unordered_set<Offset> seen;
+		auto unique = std::remove_if(output.begin(), output.end(), [&](Offset offset) { return !seen.insert(offset).second; });
+		stage.rejected(output.end() - unique);
+		output.erase(unique, output.end());
+		stage.produced(output.size());
+
+		auto outputStr = formatList("0x%p", output);
+		DPRINT_LOW("  %s -> %s", stepName(node->step), outputStr.c_str());
+		auto& result = results[node.get()];
+		result.first = node;
+		result.second = std::move(output);
+		return result.second;
+	}
+
+	std::vector<Offset> SignatureEngine::evaluate(const Signature& signature) {
+		std::lock_guard<std::mutex> guard(lock);
+		return evaluateNode(signature.get());
+	}
+	std::optional<SignatureEngine::Origin> SignatureEngine::findOrigin(Offset offset) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto find = origins.find(offset);
+		if (find == origins.end()) return std::nullopt;
+		return find->second;
+	}
+	std::optional<Offset> SignatureEngine::resolve(const char* name, const Signature& signature) {
+		DPRINT_LOW("Searching for %s offset...", name);
+		AnalysisStage stage(name);
+		auto offsets = evaluate(signature);
+		if (offsets.size() != 1) {
+			DPRINT_LOW("  Signature for %s matched %d offsets.", name, offsets.size());
+			stage.rejected(offsets.size());
+			if (DisassemblyLog::isEnabled()) dumpFailure(name, signature);
+			return std::nullopt;
+		}
+		stage.produced(1);
+		auto description = module.describeOffset(offsets[0]);
+		DPRINT_LOW("  %s = 0x%p (%s)", name, offsets[0], description.c_str());
+		return offsets[0];
+	}
+	// Dumps the functions containing the offsets found by the last step of a signature that found any, which is
+	// usually the step that needs updating.
+	void SignatureEngine::dumpFailure(const char* name, const Signature& signature) {
+		static const size_t kMaxFunctions = 8;
+
+		std::lock_guard<std::mutex> guard(lock);
+		auto& log = DisassemblyLog::instance();
+		auto node = signature.get().get();
+		for (; node; node = node->parent.get()) {
+			auto find = results.find(node);
+			if (find != results.end() && !find->second.second.empty()) break;
+		}
+		if (!node) {
+			log.note(str_format("\n%s: No step found any offsets.", name).c_str());
+			return;
+		}
+		auto& offsets = results[node].second;
+		log.note(str_format("\n%s: Step %s found %d offsets.", name, stepName(node->step), offsets.size()).c_str());
+
+		std::vector<Offset> entries;
+		for (auto offset : offsets) {
+			auto range = module.functions().findFunction(offset);
+			if (!range.has_value() || std::find(entries.begin(), entries.end(), range->start) != entries.end()) continue;
+			entries.push_back(range->start);
+			if (entries.size() == kMaxFunctions) break;
+		}
+		for (auto entry : entries) {
+			auto function = getFunction(entry);
+			if (function) ANALYSIS_DBG_DISASSEMBLY(module, *function);
+		}
+	}
+#pragma endregion
+}
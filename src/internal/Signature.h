@@ -0,0 +1,138 @@
+#pragma once
+
+#include "AnalysisCore.h"
+#include "Scanner.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace aiModInternal {
+	struct AnalysisStage;
+
+	enum class SignatureStep : uint8_t {
+		String, Pattern, Export, Offset, Only, First, RefsIn, Entries, Calls, CallAt, CallsMatching, FirstCallTo,
+		CalledFrom, Intersect, MatchInstruction, Vftable, PassedTo,
+	};
+	// Returns an address used by an instruction. The address is translated from an image address to an offset.
+	typedef std::optional<Offset> (*InstructionMatcher)(const DecodedInstruction&);
+
+	// A chain of steps that locates an offset in a module. Each step maps the offsets found by the step
+	// before it to a new list of offsets, e.g.:
+	//
+	//     Signature::fromString("kBlockOverlap\0"s, ".rdata").only().refsIn(".text").callAt(0)
+	//
+	// finds the first call made after the only reference to a string. Signatures are immutable and share
+	// their prefixes, so a chain stored in a variable and extended twice is only evaluated once. Each step
+	// drops duplicate offsets, but keeps the first occurrence of each in place, so offsets stay in the order
+	// they were found in.
+	struct Signature final {
+		struct Node {
+			SignatureStep step;
+			std::shared_ptr<const Node> parent;
+			std::shared_ptr<const Node> other;
+			string str;
+			const char* name = NULL;
+			ptrdiff_t delta = 0;
+			size_t count = 0;
+			bool unique = false;
+			InstructionMatcher matcher = NULL;
+		};
+
+		Signature() { }
+
+		// The offsets of a string in a segment.
+		static Signature fromString(string str, const char* segment);
+		// The offsets of a byte pattern with wildcards in a segment, e.g. `E8 ?? ?? ?? ?? 8B 0D`.
+		static Signature fromPattern(const char* pattern, const char* segment);
+		// The offset of an exported function.
+		static Signature fromExport(const char* name);
+		// The primary vftable of a class with RTTI, e.g. `CVarBase`.
+		static Signature fromVftable(const char* className);
+
+		Signature offset(ptrdiff_t delta) const;
+		// Fails unless exactly one offset was found.
+		Signature only() const;
+		// Keeps the first offset found, for searches that try candidates in order and take the first that fits.
+		Signature first() const;
+		// The locations in a segment that contain each offset. When unique is set, offsets referenced from
+		// more than one location are dropped.
+		Signature refsIn(const char* segment, bool unique = false) const;
+		// The potential entry points of the functions containing each offset, closest first. Entries that don't
+		// parse, or whose function overlaps one found earlier, are dropped.
+		Signature entries(size_t maxInstructions) const;
+
+		// The following steps parse a function starting at each offset.
+		Signature calls() const;
+		// The call at the given index, if the function makes expectedCount calls (or any number, if 0).
+		Signature callAt(size_t index, size_t expectedCount = 0) const;
+		// Tries the offsets found by target in order, and returns the call relative to the first call to the
+		// first of them that is called at minIndex or later, and has a call at the relative index.
+		Signature callsMatching(const Signature& target, ptrdiff_t relative = 0, size_t minIndex = 0) const;
+		// Keeps functions whose first call is to an offset found by target.
+		Signature firstCallTo(const Signature& target) const;
+		// Keeps offsets that one of the functions found by caller has a direct call instruction to.
+		Signature calledFrom(const Signature& caller) const;
+		Signature intersect(const Signature& other) const;
+		Signature matchInstruction(InstructionMatcher matcher, const char* criteria = NULL) const;
+		// The values passed in an argument of each call to an offset found by target, using the data flow in
+		// DataFlow.h. Stack arguments are numbered from 0, and kThisArgument is ECX. Constants and loads give
+		// the address in the module they refer to, and call results give the function that was called.
+		static const int kThisArgument = -1;
+		Signature passedTo(const Signature& target, int argument) const;
+
+		inline const std::shared_ptr<const Node>& get() const {
+			return node;
+		}
+
+	private:
+		std::shared_ptr<const Node> node;
+
+		Signature(std::shared_ptr<const Node> node) : node(node) { }
+		Signature then(Node next) const;
+	};
+
+	// Evaluates signatures against a module. Every string used by the signatures given up front is found by
+	// a single scan of each segment, and the result of every step is memoized, so signatures sharing a prefix
+	// or a parsed function never repeat work. A string or pattern only followed by only() or first() is
+	// scanned for its first two or one occurrences, so the shared scan can stop early. See ScanBatch.
+	struct SignatureEngine final {
+		SignatureEngine(const PEModule& module, const std::vector<Signature>& signatures = {});
+		SignatureEngine(const SignatureEngine&) = delete;
+
+		// Where an offset found by a call step or matchInstruction came from: the instruction, and the address it
+		// uses. That is the offset itself for a call, and differs from it when offset() follows the step.
+		struct Origin {
+			Offset instruction;
+			Offset address;
+		};
+
+		std::vector<Offset> evaluate(const Signature& signature);
+		// Evaluates a signature, and returns its result if it found exactly one offset.
+		std::optional<Offset> resolve(const char* name, const Signature& signature);
+		// The origin of an offset found by an evaluated signature. When several instructions lead to the same
+		// offset, the first one found is kept.
+		std::optional<Origin> findOrigin(Offset offset);
+
+	private:
+		const PEModule& module;
+		std::mutex lock;
+		std::unordered_map<string, std::unique_ptr<ScanBatch>> scans;
+		// Results hold on to their node, so a node can't be freed and its address reused for another one.
+		std::unordered_map<const Signature::Node*, std::pair<std::shared_ptr<const Signature::Node>, std::vector<Offset>>> results;
+		std::unordered_map<Offset, std::optional<ParsedFunction>> functions;
+		std::unordered_map<Offset, Origin> origins;
+
+		ScanBatch& getScan(const char* segment);
+		void addNeedles(const Signature::Node* node);
+		// The first limit offsets of a String or Pattern step.
+		std::vector<Offset> findNeedle(const Signature::Node* node, size_t limit);
+		const std::vector<Offset>& evaluateNode(const std::shared_ptr<const Signature::Node>& node);
+		std::vector<Offset> evaluateStep(const Signature::Node* node, const std::vector<Offset>& input, AnalysisStage& stage);
+		void parseFunctions(const std::vector<Offset>& offsets);
+		const ParsedFunction* getFunction(Offset offset);
+		void dumpFailure(const char* name, const Signature& signature);
+	};
+}
@@ -0,0 +1,102 @@
+#include <game/StdAfx.h>
+
+#include "ThreadPool.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <thread>
+
+namespace aiModInternal {
+	static const size_t NO_WORKER = ~(size_t) 0;
+
+	ThreadPool::ThreadPool(size_t threadCount) {
+		ASSERT_FATAL(threadCount > 0);
+		for (size_t i = 0; i < threadCount; i++) workers.push_back(std::make_unique<Worker>());
+		for (size_t i = 0; i < threadCount; i++) std::thread([this, i]() { workerMain(i); }).detach();
+	}
+	ThreadPool& ThreadPool::instance() {
+		static ThreadPool& pool = *new ThreadPool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+		return pool;
+	}
+
+	void ThreadPool::submit(Task task) {
+		auto& worker = *workers[nextWorker++ % workers.size()];
+		{
+			std::lock_guard<std::mutex> guard(worker.lock);
+			worker.tasks.push_back(std::move(task));
+		}
+		queuedTasks++;
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		wakeup.notify_one();
+	}
+
+	bool ThreadPool::tryRunTask(size_t preferredWorker) {
+		Task task;
+		if (preferredWorker != NO_WORKER) {
+			auto& worker = *workers[preferredWorker];
+			std::lock_guard<std::mutex> guard(worker.lock);
+			if (!worker.tasks.empty()) {
+				task = std::move(worker.tasks.back());
+				worker.tasks.pop_back();
+			}
+		}
+		for (size_t i = 0; !task && i < workers.size(); i++) {
+			auto& worker = *workers[(preferredWorker + 1 + i) % workers.size()];
+			std::lock_guard<std::mutex> guard(worker.lock);
+			if (!worker.tasks.empty()) {
+				task = std::move(worker.tasks.front());
+				worker.tasks.pop_front();
+			}
+		}
+		if (!task) return false;
+
+		queuedTasks--;
+		task();
+		return true;
+	}
+
+	void ThreadPool::workerMain(size_t index) {
+		for (;;) {
+			if (tryRunTask(index)) continue;
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wakeup.wait(guard, [this]() { return queuedTasks > 0; });
+		}
+	}
+
+	void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+		if (count == 0) return;
+		if (count == 1) {
+			fn(0);
+			return;
+		}
+
+		// Split the range into a few chunks per thread, so small tasks don't each pay for a queue operation.
+		auto chunkCount = std::min(count, (workers.size() + 1) * 4);
+		auto chunkSize = (count + chunkCount - 1) / chunkCount;
+		std::atomic<size_t> remaining = { count };
+		for (size_t start = 0; start < count; start += chunkSize) {
+			auto end = std::min(start + chunkSize, count);
+			submit([&fn, &remaining, start, end]() {
+				for (auto i = start; i < end; i++) fn(i);
+				remaining -= end - start;
+			});
+		}
+
+		while (remaining > 0)
+			if (!tryRunTask(NO_WORKER)) std::this_thread::yield();
+	}
+
+	void TaskGroup::run(ThreadPool::Task task) {
+		pending++;
+		pool.submit([this, task = std::move(task)]() {
+			task();
+			pending--;
+		});
+	}
+	void TaskGroup::wait() {
+		while (pending > 0)
+			if (!pool.tryRunTask(NO_WORKER)) std::this_thread::yield();
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aiModInternal {
+	// A small work-stealing thread pool. Each worker pops tasks from the back of its own queue, and steals from
+	// the front of the other queues when it runs dry.
+	//
+	// A thread waiting on a batch of tasks runs queued tasks itself while it waits. This keeps batches from
+	// deadlocking when the workers cannot start yet, e.g. when analysis runs under the loader lock.
+	struct ThreadPool final {
+		typedef std::function<void()> Task;
+		friend struct TaskGroup;
+
+		explicit ThreadPool(size_t threadCount);
+		ThreadPool(const ThreadPool&) = delete;
+
+		// The shared pool. It is never destroyed, as joining threads during DLL unload would deadlock.
+		static ThreadPool& instance();
+
+		inline size_t threadCount() const {
+			return workers.size();
+		}
+
+		// Calls fn(i) for every i in [0, count), and returns once all calls have completed.
+		void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+	private:
+		struct Worker {
+			std::mutex lock;
+			std::deque<Task> tasks;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::atomic<size_t> nextWorker = { 0 };
+		std::atomic<size_t> queuedTasks = { 0 };
+		std::mutex sleepLock;
+		std::condition_variable wakeup;
+
+		void submit(Task task);
+		bool tryRunTask(size_t preferredWorker);
+		void workerMain(size_t index);
+	};
+
+	// Tasks forked onto a pool, which are joined together. Like parallelFor, the joining thread runs queued tasks
+	// while it waits, so tasks can fork and join groups of their own.
+	struct TaskGroup final {
+		explicit TaskGroup(ThreadPool& pool = ThreadPool::instance()) : pool(pool) { }
+		TaskGroup(const TaskGroup&) = delete;
+		~TaskGroup() {
+			wait();
+		}
+
+		void run(ThreadPool::Task task);
+		// Returns once every task run in the group has completed.
+		void wait();
+
+	private:
+		ThreadPool& pool;
+		std::atomic<size_t> pending = { 0 };
+	};
+}
@@ -3,34 +3,89 @@
 #include "Utils.h"
 #include "Macros.h"
 
-#include <windows.h>
 #include <algorithm>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace aiModInternal {
+#ifdef _WIN32
 	EXTERN_C IMAGE_DOS_HEADER __ImageBase;
-	string getModuleName(HMODULE mod) {
+	string getModulePath(HMODULE mod) {
 		char DllPath[MAX_PATH] = { 0 };
 		GetModuleFileNameA(mod, DllPath, _countof(DllPath));
-		auto filename = strrchr(DllPath, '\\');
-		return string(filename == NULL ? DllPath : filename + 1);
+		return string(DllPath);
+	}
+#else
+	// Outside of Windows, the analysis code is linked into a standalone tool rather than loaded as a DLL.
+	string getModulePath(HMODULE mod) {
+		return "aimod";
+	}
+#endif
+	string getModuleName(HMODULE mod) {
+		auto path = getModulePath(mod);
+		auto filename = path.find_last_of('\\');
+		return filename == string::npos ? path : path.substr(filename + 1);
+	}
+	static HMODULE getSelfModule() {
+#ifdef _WIN32
+		return (HINSTANCE) &__ImageBase;
+#else
+		return NULL;
+#endif
 	}
 	const char* getSelfModuleName() {
-		static const string name = getModuleName((HINSTANCE) &__ImageBase);
+		static const string name = getModuleName(getSelfModule());
 		return name.c_str();
 	}
+	const char* getSelfModulePath() {
+		static const string path = getModulePath(getSelfModule());
+		return path.c_str();
+	}
+
+	size_t getProcessMemoryUsage() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS_EX counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*) &counters, sizeof(counters))) return 0;
+		return counters.PrivateUsage;
+#else
+		auto file = fopen("/proc/self/statm", "r");
+		if (!file) return 0;
+		unsigned long size = 0, resident = 0;
+		auto read = fscanf(file, "%lu %lu", &size, &resident);
+		fclose(file);
+		return read == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#endif
+	}
 
 	[[noreturn]] void reportFatalError0(const char* lineInfo, string error) {
-		auto msg = str_format("Fatal error in %s %s: %s", getSelfModuleName(), lineInfo, error);
+		auto msg = str_format("Fatal error in %s %s: %s", getSelfModuleName(), lineInfo, error.c_str());
 		fprintf(stderr, "%s\n", msg.c_str());
+#ifdef _WIN32
 		MessageBoxA(NULL, msg.c_str(), "Reassembly", MB_OK | MB_ICONERROR);
 
 		// We kill ourselves to prevent any error handling from running.
 		auto hnd = OpenProcess(SYNCHRONIZE | PROCESS_TERMINATE, TRUE, GetCurrentProcessId());
 		TerminateProcess(hnd, 0);
+#else
+		abort();
+#endif
 	}
 
 	ENUM_TO_STR_FN(eDebugName, EDebug, DBG_TYPES);
 
+	// Analysis may log from the thread pool, so writes are serialized. The lock is only held while writing,
+	// as looking up globals below can run analysis itself.
+	static std::mutex reportLock;
+	static void writeReport(const string& str, bool toGame) {
+		std::lock_guard<std::mutex> guard(reportLock);
+		if (toGame) ::Report(str);
+		else printf("\n%s", str.c_str());
+	}
+
 	static std::once_flag printedGlobalsWarning;
 	void aiReportImpl(EDebug debug, string reportStr, bool isInternal, bool alwaysReport) {
 		ASSERT_FATAL((debug || isInternal) && !(debug && isInternal));
@@ -40,20 +95,20 @@ namespace aiModInternal {
 		auto str = str_format("[%s] %s - %s", name, moduleName, reportStr.c_str());
 
 		if (alwaysReport || isInternal) {
-			::Report(str);
+			writeReport(str, true);
 			return;
 		}
 		if (!isInternal) {
-			auto globals = tryGetGlobals();
-			if (!globals) std::call_once(printedGlobalsWarning, []() { 
+			auto gameGlobals = tryGetGlobals();
+			if (!gameGlobals) std::call_once(printedGlobalsWarning, []() { 
 				DPRINT_LOW_REPORT("Could not find globals offset. AI mod logging has been disabled.");
 			});
-			if (globals.has_value() && ((*globals)->debugRender & debug)) {
-				::Report(str);
+			if (gameGlobals.has_value() && ((*gameGlobals)->debugRender & debug)) {
+				writeReport(str, true);
 				return;
 			}
 		}
-		printf("\n%s", str.c_str());
+		writeReport(str, false);
 	}
 
 	static std::once_flag printedCvarsWarning;
@@ -3,11 +3,15 @@
 #include <core/Str.h>
 #include <game/Save.h>
 
-#include <Windows.h>
+#include "PEFormat.h"
 
 namespace aiModInternal {
+	string getModulePath(HMODULE mod);
 	string getModuleName(HMODULE mod);
 	const char* getSelfModuleName();
+	const char* getSelfModulePath();
+	// The private memory committed by this process, or its resident set outside of Windows.
+	size_t getProcessMemoryUsage();
 	[[noreturn]] void reportFatalError0(const char* lineInfo, string error);
 	void aiReportImpl(EDebug debug, string reportStr, bool isInternal, bool alwaysReport);
 
@@ -0,0 +1,121 @@
+#include <game/StdAfx.h>
+#include <core/Str.h>
+
+#include "XrefIndex.h"
+#include "ThreadPool.h"
+#include "AnalysisStats.h"
+#include "Macros.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+namespace aiModInternal {
+	typedef std::vector<std::pair<Offset, Offset>> EdgeList;
+
+	static const size_t SWEEP_CHUNK_SIZE = 0x40000;
+
+	// Runs fn over every position of a segment at which a window of the given size starts. Chunks of the
+	// segment are swept in parallel, and the edges they find are collected into a single list.
+	template <typename Fn> static EdgeList sweepSegment(const Segment& segment, size_t windowSize, Fn fn) {
+		if (segment.length < windowSize) return EdgeList();
+		auto positions = segment.length - windowSize + 1;
+		auto chunkCount = (positions + SWEEP_CHUNK_SIZE - 1) / SWEEP_CHUNK_SIZE;
+
+		std::vector<EdgeList> chunkEdges(chunkCount);
+		ThreadPool::instance().parallelFor(chunkCount, [&](size_t chunk) {
+			auto start = chunk * SWEEP_CHUNK_SIZE;
+			auto end = std::min(start + SWEEP_CHUNK_SIZE, positions);
+			for (auto i = start; i < end; i++) fn(segment.base + i, chunkEdges[chunk]);
+		});
+
+		EdgeList edges;
+		for (auto& list : chunkEdges) edges.insert(edges.end(), list.begin(), list.end());
+		return edges;
+	}
+
+#pragma region Table
+	void XrefIndex::Table::build(EdgeList& edges) {
+		std::sort(edges.begin(), edges.end());
+		sites.reserve(edges.size());
+		for (size_t i = 0; i < edges.size();) {
+			auto target = edges[i].first;
+			auto start = i;
+			for (; i < edges.size() && edges[i].first == target; i++) sites.push_back(edges[i].second);
+			ranges[target] = { (uint32_t) start, (uint32_t) (i - start) };
+		}
+	}
+	std::vector<Offset> XrefIndex::Table::lookup(Offset target) const {
+		auto find = ranges.find(target);
+		if (find == ranges.end()) return std::vector<Offset>();
+		auto begin = sites.begin() + find->second.first;
+		return std::vector<Offset>(begin, begin + find->second.second);
+	}
+#pragma endregion
+
+	XrefIndex::XrefIndex(const PEModule& module) {
+		text = module.getSegment(".text");
+		imageBase = module.imageBase();
+		preferredBase = module.toImageAddress(imageBase);
+		for (auto name : { ".rdata", ".data" }) {
+			auto segment = module.tryGetSegment(name);
+			if (segment.has_value()) targetSegments.push_back(*segment);
+		}
+		for (auto& segment : module.getSegments()) {
+			sourceSegments[segment.name] = segment;
+			refTables[segment.name] = std::make_unique<Table>();
+		}
+	}
+
+	bool XrefIndex::isRefTarget(Offset offset) const {
+		for (auto& segment : targetSegments) if (segment.containsOffset(offset)) return true;
+		return false;
+	}
+	void XrefIndex::buildRefs(const Segment& source, Table& table) const {
+		DPRINT_LOW("Building data reference index for segment %s...", source.name.c_str());
+		auto edges = sweepSegment(source, 4, [this](Offset position, EdgeList& out) {
+			uint32_t value;
+			memcpy(&value, position, 4);
+			auto target = imageBase + (uint32_t) (value - preferredBase);
+			if (isRefTarget(target)) out.push_back({ target, position });
+		});
+		AnalysisStage::addBytesScanned(source.length);
+		table.build(edges);
+		DPRINT_LOW("  Found %d references to %d targets.", table.sites.size(), table.ranges.size());
+	}
+	void XrefIndex::buildCalls(Table& table) const {
+		DPRINT_LOW("Building call index for segment %s...", text.name.c_str());
+		auto edges = sweepSegment(text, 5, [this](Offset position, EdgeList& out) {
+			if (*position != 0xE8) return;
+			int32_t displacement;
+			memcpy(&displacement, position + 1, 4);
+			auto target = position + 5 + displacement;
+			if (text.containsOffset(target)) out.push_back({ target, position });
+		});
+		AnalysisStage::addBytesScanned(text.length);
+		table.build(edges);
+		DPRINT_LOW("  Found %d call sites to %d targets.", table.sites.size(), table.ranges.size());
+	}
+
+	std::vector<Offset> XrefIndex::refsTo(Offset target, const char* segment) {
+		auto find = refTables.find(segment);
+		if (find == refTables.end()) reportFatalError("Could not find segment %s", segment);
+		auto& table = *find->second;
+		std::call_once(table.built, [&]() { buildRefs(sourceSegments.at(segment), table); });
+		return table.lookup(target);
+	}
+	std::optional<Offset> XrefIndex::findOnlyRefTo(Offset target, const char* segment) {
+		return ifOnly(refsTo(target, segment));
+	}
+
+	std::vector<Offset> XrefIndex::callersOf(Offset function) {
+		std::call_once(callTable.built, [&]() { buildCalls(callTable); });
+		return callTable.lookup(function);
+	}
+	std::vector<Offset> XrefIndex::callTargets(size_t minCallers) {
+		std::call_once(callTable.built, [&]() { buildCalls(callTable); });
+		std::vector<Offset> targets;
+		for (auto& range : callTable.ranges) if (range.second.second >= minCallers) targets.push_back(range.first);
+		std::sort(targets.begin(), targets.end());
+		return targets;
+	}
+}
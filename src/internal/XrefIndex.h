@@ -0,0 +1,54 @@
+#pragma once
+
+#include "AnalysisCore.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace aiModInternal {
+	// Cross references within a module, so analysis can look up what refers to an address instead of scanning
+	// for it. Each table is built by a single sweep over its segment the first time it is queried, and kept
+	// for the lifetime of the process.
+	//
+	// Both tables are found by sweeping over every byte position rather than by disassembly, so they can
+	// contain false positives. Callers are expected to check the results against a parsed function.
+	struct XrefIndex final {
+		XrefIndex(const PEModule& module);
+		XrefIndex(const XrefIndex&) = delete;
+
+		// Locations in the given segment holding the absolute address of a target in .rdata or .data. Addresses
+		// are translated from image addresses, so this also works for an image read from disk.
+		std::vector<Offset> refsTo(Offset target, const char* segment);
+		std::optional<Offset> findOnlyRefTo(Offset target, const char* segment);
+
+		// Sites of `call rel32` instructions in .text that call the given offset.
+		std::vector<Offset> callersOf(Offset function);
+		// Offsets in .text called from at least minCallers call sites, sorted.
+		std::vector<Offset> callTargets(size_t minCallers);
+
+	private:
+		struct Table {
+			std::once_flag built;
+			std::vector<Offset> sites; // Grouped by target, and sorted within each group.
+			std::unordered_map<Offset, std::pair<uint32_t, uint32_t>> ranges;
+
+			void build(std::vector<std::pair<Offset, Offset>>& edges);
+			std::vector<Offset> lookup(Offset target) const;
+		};
+
+		Segment text;
+		Offset imageBase;
+		uint32_t preferredBase;
+		std::vector<Segment> targetSegments;
+		std::unordered_map<string, Segment> sourceSegments;
+		std::unordered_map<string, std::unique_ptr<Table>> refTables;
+		Table callTable;
+
+		bool isRefTarget(Offset offset) const;
+		void buildRefs(const Segment& source, Table& table) const;
+		void buildCalls(Table& table) const;
+	};
+}
@@ -1,6 +1,13 @@
 // This is its own file to avoid initializing globals if avoidable.
+//
+// Static initializers run under the loader lock, and the background analysis thread can't start until it is
+// released, so nothing here may wait for that thread. Offsets needed during static initialization are
+// resolved on the loading thread instead. For `globals` that only parses one exported function. A
+// DEFINE_CVAR at namespace scope resolves CVarBase::index the same way, which scans the executable before the
+// mod finishes loading. CVars that aren't needed right away can be function-local statics instead.
 
 #include <game/StdAfx.h>
 #include "internal/Analysis.h"
 
+static const bool backgroundAnalysisStarted = (aiModInternal::startBackgroundAnalysis(), true);
 Globals& globals = aiModInternal::getGlobals();
\ No newline at end of file